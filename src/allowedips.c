@@ -179,6 +179,7 @@ static int add(struct allowedips_node __rcu **trie, u8 bits, const u8 *key,
 	       u8 cidr, struct wg_peer *peer, struct mutex *lock)
 {
 	struct allowedips_node *node, *parent, *down, *newnode;
+	struct wg_peer *old;
 
 	if (unlikely(cidr > bits || !peer))
 		return -EINVAL;
@@ -194,6 +195,11 @@ static int add(struct allowedips_node __rcu **trie, u8 bits, const u8 *key,
 		return 0;
 	}
 	if (node_placement(*trie, key, cidr, bits, &node, lock)) {
+		old = rcu_dereference_protected(node->peer,
+						lockdep_is_held(lock));
+		/* The previous owner just lost this allowed IP. */
+		if (old && old != peer)
+			wg_peer_bump_generation(old);
 		rcu_assign_pointer(node->peer, peer);
 		list_move_tail(&node->peer_list, &peer->allowedips_list);
 		return 0;
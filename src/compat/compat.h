@@ -232,6 +232,15 @@ static inline u32 __compat_prandom_u32_max(u32 ep_ro)
 #define prandom_u32_max __compat_prandom_u32_max
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 18, 0)
+#include <linux/kernel.h>
+static inline u32 __compat_reciprocal_scale(u32 val, u32 ep_ro)
+{
+	return (u32)(((u64)val * ep_ro) >> 32);
+}
+#define reciprocal_scale __compat_reciprocal_scale
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 14, 0)
 #include <linux/kernel.h>
 #ifndef U8_MAX
@@ -585,12 +594,26 @@ static inline struct nlattr **genl_family_attrbuf(const struct genl_family *fami
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0)
 #define genl_register_family(a) genl_register_family_with_ops(a, genl_ops, ARRAY_SIZE(genl_ops))
 #define COMPAT_CANNOT_USE_CONST_GENL_OPS
+#define COMPAT_CANNOT_USE_GENL_MCGRPS
 #else
-#define genl_register_family(a) genl_register_family_with_ops(a, genl_ops)
+#define genl_register_family(a) genl_register_family_with_ops_groups(a, genl_ops, genl_mcgrps)
 #endif
 #define COMPAT_CANNOT_USE_GENL_NOPS
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0)
+#define COMPAT_CANNOT_USE_GENL_MCAST_BIND
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 0, 0) && LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0) && !defined(ISRHEL7)
+#include <net/genetlink.h>
+static inline int __compat_genl_has_listeners(const struct genl_family *family, struct net *net, unsigned int group)
+{
+	return netlink_has_listeners(net->genl_sock, family->mcgrp_offset + group);
+}
+#define genl_has_listeners __compat_genl_has_listeners
+#endif
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 14, 2) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)) || (LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 16) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 10, 0)) || (LINUX_VERSION_CODE < KERNEL_VERSION(4, 9, 65) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)) || (LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 101) && LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)) || LINUX_VERSION_CODE < KERNEL_VERSION(3, 18, 84)
 #define __COMPAT_NETLINK_DUMP_BLOCK { \
 	int ret; \
@@ -606,8 +629,7 @@ static inline struct nlattr **genl_family_attrbuf(const struct genl_family *fami
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 8) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0)) || (LINUX_VERSION_CODE < KERNEL_VERSION(4, 14, 25) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 10, 0)) || LINUX_VERSION_CODE < KERNEL_VERSION(4, 9, 87)
 #define wg_get_device_dump(a, b) wg_get_device_dump_real(a, b); \
 static int wg_get_device_dump(a, b) { \
-	struct wg_device *wg = (struct wg_device *)cb->args[0]; \
-	if (!wg) { \
+	if (!cb->args[0]) { \
 		int ret = wg_get_device_start(cb); \
 		if (ret) \
 			return ret; \
@@ -681,6 +703,10 @@ struct __compat_dummy_container { char dev; };
 #define from_timer(var, callback_timer, timer_fieldname) container_of(callback_timer, typeof(*var), timer_fieldname)
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+#define COMPAT_CANNOT_USE_TIMER_REDUCE
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 14, 3)
 #define COMPAT_CANNOT_USE_AVX512
 #endif
@@ -699,6 +725,15 @@ static inline void *skb_put_data(struct sk_buff *skb, const void *data, unsigned
 }
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0) && !defined(ISRHEL7)
+static inline void *skb_put_zero(struct sk_buff *skb, unsigned int len)
+{
+	void *tmp = skb_put(skb, len);
+	memset(tmp, 0, len);
+	return tmp;
+}
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0) && !defined(ISRHEL7)
 #define napi_complete_done(n, work_done) napi_complete(n)
 #endif
@@ -883,8 +918,8 @@ static inline void skb_mark_not_on_list(struct sk_buff *skb)
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0) && !defined(ISRHEL8)
 #define genl_dumpit_info(cb) ({ \
-	struct { struct nlattr **attrs; } *a = (void *)((u8 *)cb->args + offsetofend(struct dump_ctx, next_allowedip)); \
-	BUILD_BUG_ON(sizeof(cb->args) < offsetofend(struct dump_ctx, next_allowedip) + sizeof(*a)); \
+	struct { struct nlattr **attrs; } *a = (void *)&cb->args[1]; \
+	BUILD_BUG_ON(sizeof(cb->args) < sizeof(cb->args[0]) + sizeof(*a)); \
 	a->attrs = genl_family_attrbuf(&genl_family); \
 	if (nlmsg_parse(cb->nlh, GENL_HDRLEN + genl_family.hdrsize, a->attrs, genl_family.maxattr, device_policy, NULL) < 0) \
 		memset(a->attrs, 0, (genl_family.maxattr + 1) * sizeof(struct nlattr *)); \
@@ -1082,10 +1117,32 @@ static inline void skb_reset_redirect(struct sk_buff *skb)
 #define sw_hash ignore_df = 0; skb->nf_trace = skb->ooo_okay
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 3, 0)
+#include <linux/jump_label.h>
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key name = STATIC_KEY_INIT_FALSE
+#define DECLARE_STATIC_KEY_FALSE(name) extern struct static_key name
+#define static_branch_unlikely(key) static_key_false(key)
+#define static_branch_inc(key) static_key_slow_inc(key)
+#define static_branch_dec(key) static_key_slow_dec(key)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 17, 0)
+#include <linux/ktime.h>
+static inline u64 __compat_ktime_get_ns(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+#define ktime_get_ns __compat_ktime_get_ns
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
 #define pre_exit exit
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+#define COMPAT_CANNOT_USE_PERNET_FIB_NOTIFIER
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
 #include <linux/skbuff.h>
 #include <linux/ip.h>
@@ -10,6 +10,8 @@
 #include "ratelimiter.h"
 #include "peer.h"
 #include "messages.h"
+#include "trace.h"
+#include "uapi/wireguard.h"
 
 #include <linux/module.h>
 #include <linux/rtnetlink.h>
@@ -24,9 +26,56 @@
 #include <net/rtnetlink.h>
 #include <net/ip_tunnels.h>
 #include <net/addrconf.h>
+#include <net/fib_notifier.h>
+#include <net/netns/generic.h>
 
 static LIST_HEAD(device_list);
 
+static bool peer_needs_bring_up(struct wg_peer *peer)
+{
+	return peer->persistent_keepalive_interval ||
+	       !skb_queue_empty(&peer->staged_packet_queue);
+}
+
+/* Rather than having every peer initiate a handshake at once, which with many
+ * peers overwhelms both our handshake workers and the other side, we spread
+ * them evenly over bring_up_spread ms, each at a random point of its slot.
+ * The time until all of them complete a handshake is recorded in
+ * bring_up_time. The device holds its own reference in bring_up_pending
+ * until all peers have been scheduled, so that it cannot complete early.
+ */
+static void bring_up_peers(struct wg_device *wg)
+{
+	unsigned long spread = msecs_to_jiffies(wg->bring_up_spread);
+	unsigned long slot = 0, delay = 0;
+	unsigned int count = 0;
+	struct wg_peer *peer;
+
+	lockdep_assert_held(&wg->device_update_lock);
+
+	if (spread) {
+		list_for_each_entry(peer, &wg->peer_list, peer_list)
+			count += peer_needs_bring_up(peer);
+		if (count)
+			slot = max(spread / count, 1UL);
+	}
+
+	atomic_set(&wg->bring_up_pending, 1);
+	wg->bring_up_start = ktime_get_coarse_boottime_ns();
+	WRITE_ONCE(wg->bring_up_time, 0);
+	list_for_each_entry(peer, &wg->peer_list, peer_list) {
+		if (!peer_needs_bring_up(peer)) {
+			atomic_set(&peer->awaiting_bring_up, 0);
+			continue;
+		}
+		atomic_inc(&wg->bring_up_pending);
+		atomic_set(&peer->awaiting_bring_up, 1);
+		wg_timers_bring_up(peer, slot ? delay + prandom_u32_max(slot) : 0);
+		delay += slot;
+	}
+	wg_timers_bring_up_finish(wg);
+}
+
 static int wg_open(struct net_device *dev)
 {
 	struct in_device *dev_v4 = __in_dev_get_rtnl(dev);
@@ -55,14 +104,10 @@ static int wg_open(struct net_device *dev)
 #endif
 
 	mutex_lock(&wg->device_update_lock);
-	ret = wg_socket_init(wg, wg->incoming_port);
+	ret = wg_socket_init(wg, wg->incoming_port, wg->listen_port_count);
 	if (ret < 0)
 		goto out;
-	list_for_each_entry(peer, &wg->peer_list, peer_list) {
-		wg_packet_send_staged_packets(peer);
-		if (peer->persistent_keepalive_interval)
-			wg_packet_send_keepalive(peer);
-	}
+	bring_up_peers(wg);
 out:
 	mutex_unlock(&wg->device_update_lock);
 	return ret;
@@ -89,7 +134,7 @@ static int wg_pm_notification(struct notifier_block *nb, unsigned long action,
 	list_for_each_entry(wg, &device_list, device_list) {
 		mutex_lock(&wg->device_update_lock);
 		list_for_each_entry(peer, &wg->peer_list, peer_list) {
-			del_timer(&peer->timer_zero_key_material);
+			wg_timers_cancel(peer, WG_TIMER_ZERO_KEY_MATERIAL);
 			wg_noise_handshake_clear(&peer->handshake);
 			wg_noise_keypairs_clear(&peer->keypairs);
 		}
@@ -119,15 +164,16 @@ static int wg_stop(struct net_device *dev)
 	}
 	mutex_unlock(&wg->device_update_lock);
 	while ((skb = ptr_ring_consume(&wg->handshake_queue.ring)) != NULL)
-		kfree_skb(skb);
+		wg_packet_drop(wg, skb, WGDROP_FLUSHED);
 	atomic_set(&wg->handshake_queue_len, 0);
-	wg_socket_reinit(wg, NULL, NULL);
+	wg_socket_reinit(wg, NULL, NULL, 0);
 	return 0;
 }
 
 static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct wg_device *wg = netdev_priv(dev);
+	enum wgdrop_reason reason;
 	struct sk_buff_head packets;
 	struct wg_peer *peer;
 	struct sk_buff *next;
@@ -137,6 +183,7 @@ static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	if (unlikely(!wg_check_packet_protocol(skb))) {
 		ret = -EPROTONOSUPPORT;
+		reason = WGDROP_TX_INVALID_PROTOCOL;
 		net_dbg_ratelimited("%s: Invalid IP packet\n", dev->name);
 		goto err;
 	}
@@ -144,6 +191,7 @@ static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 	peer = wg_allowedips_lookup_dst(&wg->peer_allowedips, skb);
 	if (unlikely(!peer)) {
 		ret = -ENOKEY;
+		reason = WGDROP_TX_NO_PEER;
 		if (skb->protocol == htons(ETH_P_IP))
 			net_dbg_ratelimited("%s: No peer has allowed IPs matching %pI4\n",
 					    dev->name, &ip_hdr(skb)->daddr);
@@ -156,6 +204,7 @@ static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 	family = READ_ONCE(peer->endpoint.addr.sa_family);
 	if (unlikely(family != AF_INET && family != AF_INET6)) {
 		ret = -EDESTADDRREQ;
+		reason = WGDROP_TX_NO_ENDPOINT;
 		net_dbg_ratelimited("%s: No valid endpoint has been configured or discovered for peer %llu\n",
 				    dev->name, peer->internal_id);
 		goto err_peer;
@@ -171,6 +220,7 @@ static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 
 		if (IS_ERR(segs)) {
 			ret = PTR_ERR(segs);
+			reason = WGDROP_TX_GSO_FAILED;
 			goto err_peer;
 		}
 		dev_kfree_skb(skb);
@@ -181,8 +231,10 @@ static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 		skb_mark_not_on_list(skb);
 
 		skb = skb_share_check(skb, GFP_ATOMIC);
-		if (unlikely(!skb))
+		if (unlikely(!skb)) {
+			wg_count_drop(wg, WGDROP_NOMEM);
 			continue;
+		}
 
 		/* We only need to keep the original dst around for icmp,
 		 * so at this point we're in a position to drop it.
@@ -190,6 +242,9 @@ static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 		skb_dst_drop(skb);
 
 		PACKET_CB(skb)->mtu = mtu;
+		PACKET_CB(skb)->txq = skb_get_queue_mapping(skb);
+		wg_latency_stamp(wg, skb);
+		trace_wg_xmit(peer, NULL, 0, skb->len);
 
 		__skb_queue_tail(&packets, skb);
 	}
@@ -199,8 +254,9 @@ static netdev_tx_t wg_xmit(struct sk_buff *skb, struct net_device *dev)
 	 * until it's small again. We do this before adding the new packet, so
 	 * we don't remove GSO segments that are in excess.
 	 */
-	while (skb_queue_len(&peer->staged_packet_queue) > MAX_STAGED_PACKETS) {
-		dev_kfree_skb(__skb_dequeue(&peer->staged_packet_queue));
+	while (skb_queue_len(&peer->staged_packet_queue) > wg->max_staged_packets) {
+		wg_packet_drop(wg, __skb_dequeue(&peer->staged_packet_queue),
+			       WGDROP_TX_STAGED_EVICTED);
 		++dev->stats.tx_dropped;
 	}
 	skb_queue_splice_tail(&packets, &peer->staged_packet_queue);
@@ -220,7 +276,7 @@ err_icmp:
 		icmpv6_ndo_send(skb, ICMPV6_DEST_UNREACH, ICMPV6_ADDR_UNREACH, 0);
 err:
 	++dev->stats.tx_errors;
-	kfree_skb(skb);
+	wg_packet_drop(wg, skb, reason);
 	return ret;
 }
 
@@ -236,12 +292,16 @@ static void wg_destruct(struct net_device *dev)
 	struct wg_device *wg = netdev_priv(dev);
 
 	rtnl_lock();
-	list_del(&wg->device_list);
+	list_del_rcu(&wg->device_list);
 	rtnl_unlock();
+	/* Route prewarming walks the device list under RCU, and queues work on
+	 * the workqueues destroyed below.
+	 */
+	synchronize_net();
 	mutex_lock(&wg->device_update_lock);
 	rcu_assign_pointer(wg->creating_net, NULL);
 	wg->incoming_port = 0;
-	wg_socket_reinit(wg, NULL, NULL);
+	wg_socket_reinit(wg, NULL, NULL, 0);
 	/* The final references are cleared in the below calls to destroy_workqueue. */
 	wg_peer_remove_all(wg);
 	destroy_workqueue(wg->handshake_receive_wq);
@@ -254,6 +314,9 @@ static void wg_destruct(struct net_device *dev)
 	wg_ratelimiter_uninit();
 	memzero_explicit(&wg->static_identity, sizeof(wg->static_identity));
 	free_percpu(dev->tstats);
+	free_percpu(wg->drops);
+	wg_latency_stats_free(wg);
+	kfree(wg->tx_queues);
 	kvfree(wg->index_hashtable);
 	kvfree(wg->peer_hashtable);
 	mutex_unlock(&wg->device_update_lock);
@@ -304,12 +367,115 @@ static void wg_setup(struct net_device *dev)
 	wg->dev = dev;
 }
 
+static const struct nla_policy link_policy[WGLINK_A_MAX + 1] = {
+	[WGLINK_A_MAX_STAGED_PACKETS]	= { .type = NLA_U32 },
+	[WGLINK_A_MAX_QUEUED_PACKETS]	= { .type = NLA_U32 },
+	[WGLINK_A_MAX_QUEUED_HANDSHAKES] = { .type = NLA_U32 },
+	[WGLINK_A_KEEPALIVE_TIMEOUT]	= { .type = NLA_U32 },
+	[WGLINK_A_PEER_HASHTABLE_BITS]	= { .type = NLA_U8 },
+	[WGLINK_A_INDEX_HASHTABLE_BITS]	= { .type = NLA_U8 }
+};
+
+static int get_link_u32(struct nlattr *attr, u32 min, u32 max, u32 *val)
+{
+	if (!attr)
+		return 0;
+	if (nla_get_u32(attr) < min || nla_get_u32(attr) > max)
+		return -EINVAL;
+	*val = nla_get_u32(attr);
+	return 0;
+}
+
+static int get_link_u8(struct nlattr *attr, u8 min, u8 max, u8 *val)
+{
+	if (!attr)
+		return 0;
+	if (nla_get_u8(attr) < min || nla_get_u8(attr) > max)
+		return -EINVAL;
+	*val = nla_get_u8(attr);
+	return 0;
+}
+
+/* The keepalive timeout is bounded well below REJECT_AFTER_TIME, so that the
+ * last minute handshake in receive.c is still sent before keys expire.
+ */
+static int set_link_info(struct wg_device *wg, struct nlattr *data[])
+{
+	if (get_link_u32(data[WGLINK_A_MAX_STAGED_PACKETS], 1, 1U << 16,
+			 &wg->max_staged_packets) ||
+	    get_link_u32(data[WGLINK_A_MAX_QUEUED_PACKETS], 16, 1U << 16,
+			 &wg->max_queued_packets) ||
+	    get_link_u32(data[WGLINK_A_MAX_QUEUED_HANDSHAKES], 64, 1U << 16,
+			 &wg->max_queued_handshakes) ||
+	    get_link_u32(data[WGLINK_A_KEEPALIVE_TIMEOUT], 1, 60,
+			 &wg->keepalive_timeout) ||
+	    get_link_u8(data[WGLINK_A_PEER_HASHTABLE_BITS], MIN_HASHTABLE_BITS,
+			MAX_PEER_HASHTABLE_BITS, &wg->peer_hashtable_bits) ||
+	    get_link_u8(data[WGLINK_A_INDEX_HASHTABLE_BITS], MIN_HASHTABLE_BITS,
+			MAX_INDEX_HASHTABLE_BITS, &wg->index_hashtable_bits))
+		return -EINVAL;
+	return 0;
+}
+
+int wg_device_fill_link_info(struct sk_buff *skb, const struct net_device *dev)
+{
+	const struct wg_device *wg = netdev_priv(dev);
+
+	if (nla_put_u32(skb, WGLINK_A_MAX_STAGED_PACKETS,
+			wg->max_staged_packets) ||
+	    nla_put_u32(skb, WGLINK_A_MAX_QUEUED_PACKETS,
+			wg->max_queued_packets) ||
+	    nla_put_u32(skb, WGLINK_A_MAX_QUEUED_HANDSHAKES,
+			wg->max_queued_handshakes) ||
+	    nla_put_u32(skb, WGLINK_A_KEEPALIVE_TIMEOUT,
+			wg->keepalive_timeout) ||
+	    nla_put_u8(skb, WGLINK_A_PEER_HASHTABLE_BITS,
+		       wg->peer_hashtable_bits) ||
+	    nla_put_u8(skb, WGLINK_A_INDEX_HASHTABLE_BITS,
+		       wg->index_hashtable_bits))
+		return -EMSGSIZE;
+	return 0;
+}
+
+static size_t wg_get_link_info_size(const struct net_device *dev)
+{
+	return 4 * nla_total_size(sizeof(u32)) + 2 * nla_total_size(sizeof(u8));
+}
+
+/* There is a single TX queue unless more are asked for with the usual
+ * IFLA_NUM_TX_QUEUES, such as one per CPU, in which case each queue is
+ * initially steered to by its own CPU, so that transmit paths stay local, and
+ * standard tools like mq and XPS can take it from there.
+ */
+static void set_xps_queues(struct net_device *dev)
+{
+#ifdef CONFIG_XPS
+	unsigned int i;
+
+	if (dev->real_num_tx_queues <= 1)
+		return;
+	for (i = 0; i < dev->real_num_tx_queues && i < nr_cpu_ids; ++i)
+		netif_set_xps_queue(dev, cpumask_of(i), i);
+#endif
+}
+
 static int wg_newlink(struct net *src_net, struct net_device *dev,
 		      struct nlattr *tb[], struct nlattr *data[],
 		      struct netlink_ext_ack *extack)
 {
 	struct wg_device *wg = netdev_priv(dev);
 	int ret = -ENOMEM;
+	unsigned int i;
+
+	wg->max_staged_packets = MAX_STAGED_PACKETS;
+	wg->max_queued_packets = MAX_QUEUED_PACKETS;
+	wg->max_queued_handshakes = MAX_QUEUED_INCOMING_HANDSHAKES;
+	wg->keepalive_timeout = KEEPALIVE_TIMEOUT;
+	wg->peer_hashtable_bits = PEER_HASHTABLE_BITS;
+	wg->index_hashtable_bits = INDEX_HASHTABLE_BITS;
+	wg->listen_port_count = 1;
+	if (data && set_link_info(wg, data))
+		return -EINVAL;
 
 	rcu_assign_pointer(wg->creating_net, src_net);
 	init_rwsem(&wg->static_identity.lock);
@@ -320,22 +486,33 @@ static int wg_newlink(struct net *src_net, struct net_device *dev,
 	INIT_LIST_HEAD(&wg->peer_list);
 	wg->device_update_gen = 1;
 
-	wg->peer_hashtable = wg_pubkey_hashtable_alloc();
+	wg->peer_hashtable = wg_pubkey_hashtable_alloc(wg->peer_hashtable_bits);
 	if (!wg->peer_hashtable)
 		return ret;
 
-	wg->index_hashtable = wg_index_hashtable_alloc();
+	wg->index_hashtable = wg_index_hashtable_alloc(wg->index_hashtable_bits);
 	if (!wg->index_hashtable)
 		goto err_free_peer_hashtable;
 
+	wg->tx_queues = kcalloc(dev->num_tx_queues, sizeof(*wg->tx_queues),
+				GFP_KERNEL);
+	if (!wg->tx_queues)
+		goto err_free_index_hashtable;
+	for (i = 0; i < dev->num_tx_queues; ++i)
+		wg->tx_queues[i].last_cpu = i % nr_cpu_ids;
+
 	dev->tstats = netdev_alloc_pcpu_stats(struct pcpu_sw_netstats);
 	if (!dev->tstats)
-		goto err_free_index_hashtable;
+		goto err_free_tx_queues;
+
+	wg->drops = alloc_percpu(struct wg_drop_stats);
+	if (!wg->drops)
+		goto err_free_tstats;
 
 	wg->handshake_receive_wq = alloc_workqueue("wg-kex-%s",
 			WQ_CPU_INTENSIVE | WQ_FREEZABLE, 0, dev->name);
 	if (!wg->handshake_receive_wq)
-		goto err_free_tstats;
+		goto err_free_drops;
 
 	wg->handshake_send_wq = alloc_workqueue("wg-kex-%s",
 			WQ_UNBOUND | WQ_FREEZABLE, 0, dev->name);
@@ -348,17 +525,17 @@ static int wg_newlink(struct net *src_net, struct net_device *dev,
 		goto err_destroy_handshake_send;
 
 	ret = wg_packet_queue_init(&wg->encrypt_queue, wg_packet_encrypt_worker,
-				   MAX_QUEUED_PACKETS);
+				   wg->max_queued_packets);
 	if (ret < 0)
 		goto err_destroy_packet_crypt;
 
 	ret = wg_packet_queue_init(&wg->decrypt_queue, wg_packet_decrypt_worker,
-				   MAX_QUEUED_PACKETS);
+				   wg->max_queued_packets);
 	if (ret < 0)
 		goto err_free_encrypt_queue;
 
 	ret = wg_packet_queue_init(&wg->handshake_queue, wg_packet_handshake_receive_worker,
-				   MAX_QUEUED_INCOMING_HANDSHAKES);
+				   wg->max_queued_handshakes);
 	if (ret < 0)
 		goto err_free_decrypt_queue;
 
@@ -370,7 +547,9 @@ static int wg_newlink(struct net *src_net, struct net_device *dev,
 	if (ret < 0)
 		goto err_uninit_ratelimiter;
 
-	list_add(&wg->device_list, &device_list);
+	set_xps_queues(dev);
+
+	list_add_rcu(&wg->device_list, &device_list);
 
 	/* We wait until the end to assign priv_destructor, so that
 	 * register_netdevice doesn't call it for us if it fails.
@@ -394,8 +573,12 @@ err_destroy_handshake_send:
 	destroy_workqueue(wg->handshake_send_wq);
 err_destroy_handshake_receive:
 	destroy_workqueue(wg->handshake_receive_wq);
+err_free_drops:
+	free_percpu(wg->drops);
 err_free_tstats:
 	free_percpu(dev->tstats);
+err_free_tx_queues:
+	kfree(wg->tx_queues);
 err_free_index_hashtable:
 	kvfree(wg->index_hashtable);
 err_free_peer_hashtable:
@@ -406,8 +589,12 @@ err_free_peer_hashtable:
 static struct rtnl_link_ops link_ops __read_mostly = {
 	.kind			= KBUILD_MODNAME,
 	.priv_size		= sizeof(struct wg_device),
+	.maxtype		= WGLINK_A_MAX,
+	.policy			= link_policy,
 	.setup			= wg_setup,
 	.newlink		= wg_newlink,
+	.get_size		= wg_get_link_info_size,
+	.fill_info		= wg_device_fill_link_info,
 };
 
 static void wg_netns_pre_exit(struct net *net)
@@ -422,7 +609,7 @@ static void wg_netns_pre_exit(struct net *net)
 			netif_carrier_off(wg->dev);
 			mutex_lock(&wg->device_update_lock);
 			rcu_assign_pointer(wg->creating_net, NULL);
-			wg_socket_reinit(wg, NULL, NULL);
+			wg_socket_reinit(wg, NULL, NULL, 0);
 			list_for_each_entry(peer, &wg->peer_list, peer_list)
 				wg_socket_clear_peer_endpoint_src(peer);
 			mutex_unlock(&wg->device_update_lock);
@@ -431,7 +618,101 @@ static void wg_netns_pre_exit(struct net *net)
 	rtnl_unlock();
 }
 
+#ifndef COMPAT_CANNOT_USE_PERNET_FIB_NOTIFIER
+struct wg_net {
+	struct net *net;
+	struct notifier_block fib_notifier;
+	struct delayed_work route_prewarm_work;
+	unsigned long last_route_prewarm;
+	bool fib_notifier_registered;
+};
+
+static unsigned int wg_net_id __read_mostly;
+
+/* The first routing change of a burst schedules a prewarm a little later, and
+ * the changes that follow before it runs are folded into it, since a pending
+ * delayed work isn't pushed back. Prewarms of a namespace are also spaced out
+ * by at least ROUTE_PREWARM_INTERVAL, so a steady stream of changes costs at
+ * most one walk over the peers per interval.
+ */
+#define ROUTE_PREWARM_DELAY (HZ / 10)
+#define ROUTE_PREWARM_INTERVAL (HZ * 2)
+
+/* This doesn't take the RTNL or any device_update_lock, since the device list
+ * and peer lists may be walked under RCU, and peers can't be removed until
+ * the read side section is over.
+ */
+static void wg_route_prewarm_worker(struct work_struct *work)
+{
+	struct wg_net *wn = container_of(to_delayed_work(work), struct wg_net,
+					 route_prewarm_work);
+	struct wg_device *wg;
+	struct wg_peer *peer;
+
+	WRITE_ONCE(wn->last_route_prewarm, jiffies);
+	rcu_read_lock_bh();
+	list_for_each_entry_rcu(wg, &device_list, device_list) {
+		if (rcu_access_pointer(wg->creating_net) != wn->net ||
+		    !(READ_ONCE(wg->dev->flags) & IFF_UP))
+			continue;
+		list_for_each_entry_rcu(peer, &wg->peer_list, peer_list)
+			wg_socket_prewarm_peer_route(peer);
+	}
+	rcu_read_unlock_bh();
+}
+
+/* This is called atomically, including once for every existing route when
+ * registering, so it only kicks off the work.
+ */
+static int wg_fib_event(struct notifier_block *nb, unsigned long event,
+			void *ptr)
+{
+	struct wg_net *wn = container_of(nb, struct wg_net, fib_notifier);
+	unsigned long next = READ_ONCE(wn->last_route_prewarm) +
+			     ROUTE_PREWARM_INTERVAL;
+	unsigned long delay = ROUTE_PREWARM_DELAY;
+
+	if (time_before(jiffies + delay, next))
+		delay = next - jiffies;
+	queue_delayed_work(system_power_efficient_wq, &wn->route_prewarm_work,
+			   delay);
+	return NOTIFY_DONE;
+}
+
+/* Failing to register only costs prewarming, so it doesn't fail the netns. */
+static int wg_netns_init(struct net *net)
+{
+	struct wg_net *wn = net_generic(net, wg_net_id);
+	int ret;
+
+	wn->net = net;
+	wn->last_route_prewarm = jiffies - ROUTE_PREWARM_INTERVAL;
+	INIT_DELAYED_WORK(&wn->route_prewarm_work, wg_route_prewarm_worker);
+	wn->fib_notifier.notifier_call = wg_fib_event;
+	ret = register_fib_notifier(net, &wn->fib_notifier, NULL, NULL);
+	if (ret)
+		pr_debug("Not prewarming routes after changes, error %d\n", ret);
+	wn->fib_notifier_registered = !ret;
+	return 0;
+}
+
+static void wg_netns_exit(struct net *net)
+{
+	struct wg_net *wn = net_generic(net, wg_net_id);
+
+	if (wn->fib_notifier_registered)
+		unregister_fib_notifier(net, &wn->fib_notifier);
+	cancel_delayed_work_sync(&wn->route_prewarm_work);
+}
+#endif
+
 static struct pernet_operations pernet_ops = {
+#ifndef COMPAT_CANNOT_USE_PERNET_FIB_NOTIFIER
+	.init = wg_netns_init,
+	.exit = wg_netns_exit,
+	.id = &wg_net_id,
+	.size = sizeof(struct wg_net),
+#endif
 	.pre_exit = wg_netns_pre_exit
 };
 
@@ -10,6 +10,7 @@
 #include "allowedips.h"
 #include "peerlookup.h"
 #include "cookie.h"
+#include "uapi/wireguard.h"
 
 #include <linux/types.h>
 #include <linux/netdevice.h>
@@ -23,24 +24,45 @@ struct wg_device;
 struct multicore_worker {
 	void *ptr;
 	struct work_struct work;
+	u64 busy_time;
 };
 
 struct crypt_queue {
 	struct ptr_ring ring;
 	struct multicore_worker __percpu *worker;
 	int last_cpu;
+	unsigned int peak;
 };
 
 struct prev_queue {
 	struct sk_buff *head, *tail, *peeked;
 	struct { struct sk_buff *next, *prev; } empty; // Match first 2 members of struct sk_buff.
 	atomic_t count;
+	int limit, peak;
+};
+
+/* Each TX queue spreads encryption over CPUs from its own cursor, rather than
+ * every transmitting CPU contending on a single one.
+ */
+struct wg_tx_queue {
+	int last_cpu;
+} ____cacheline_aligned_in_smp;
+
+struct wg_latency_hist {
+	u64 buckets[__WGLATENCY_STAGE_COUNT][WGLATENCY_BUCKETS];
+};
+
+struct wg_drop_stats {
+	u64 count[__WGDROP_LAST];
 };
 
 struct wg_device {
 	struct net_device *dev;
 	struct crypt_queue encrypt_queue, decrypt_queue, handshake_queue;
-	struct sock __rcu *sock4, *sock6;
+	struct wg_tx_queue *tx_queues;
+	struct sock __rcu *sock4[MAX_SOCKETS_PER_DEVICE];
+	struct sock __rcu *sock6[MAX_SOCKETS_PER_DEVICE];
+	unsigned int sock_count;
 	struct net __rcu *creating_net;
 	struct noise_static_identity static_identity;
 	struct workqueue_struct *packet_crypt_wq,*handshake_receive_wq, *handshake_send_wq;
@@ -50,12 +72,22 @@ struct wg_device {
 	struct allowedips peer_allowedips;
 	struct mutex device_update_lock, socket_update_lock;
 	struct list_head device_list, peer_list;
-	atomic_t handshake_queue_len;
+	atomic_t handshake_queue_len, bring_up_pending;
+	u64 bring_up_start, bring_up_time;
 	unsigned int num_peers, device_update_gen;
+	atomic64_t peer_generation, peer_removal_generation;
 	u32 fwmark;
-	u16 incoming_port;
+	u32 max_staged_packets, max_queued_packets, max_queued_handshakes;
+	u32 keepalive_timeout, bring_up_spread;
+	u8 peer_hashtable_bits, index_hashtable_bits;
+	u16 incoming_port, listen_port_count;
+	struct wg_latency_hist __percpu *latency_hist;
+	bool latency_stats;
+	struct wg_drop_stats __percpu *drops;
 };
 
+int wg_device_fill_link_info(struct sk_buff *skb, const struct net_device *dev);
+
 int wg_device_init(void);
 void wg_device_uninit(void);
 
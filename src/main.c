@@ -9,9 +9,13 @@
 #include "queueing.h"
 #include "ratelimiter.h"
 #include "netlink.h"
+#include "pktgen.h"
 #include "uapi/wireguard.h"
 #include "crypto/zinc.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/genetlink.h>
@@ -50,6 +54,8 @@ static int __init wg_mod_init(void)
 	if (ret < 0)
 		goto err_netlink;
 
+	wg_pktgen_init();
+
 	pr_info("WireGuard " WIREGUARD_VERSION " loaded. See www.wireguard.com for information.\n");
 	pr_info("Copyright (C) 2015-2019 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.\n");
 
@@ -67,6 +73,7 @@ err_allowedips:
 
 static void __exit wg_mod_exit(void)
 {
+	wg_pktgen_uninit();
 	wg_genetlink_uninit();
 	wg_device_uninit();
 	wg_peer_uninit();
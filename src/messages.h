@@ -46,11 +46,17 @@ enum limits {
 	REJECT_AFTER_TIME = 180,
 	INITIATIONS_PER_SECOND = 50,
 	MAX_PEERS_PER_DEVICE = 1U << 20,
-	KEEPALIVE_TIMEOUT = 10,
+	MAX_SOCKETS_PER_DEVICE = 16,
+	KEEPALIVE_TIMEOUT = 10, /* Default, may be set per device */
 	MAX_TIMER_HANDSHAKES = 90 / REKEY_TIMEOUT,
 	MAX_QUEUED_INCOMING_HANDSHAKES = 4096, /* TODO: replace this with DQL */
 	MAX_STAGED_PACKETS = 128,
-	MAX_QUEUED_PACKETS = 1024 /* TODO: replace this with DQL */
+	MAX_QUEUED_PACKETS = 1024, /* TODO: replace this with DQL */
+	PEER_HASHTABLE_BITS = 11, /* Default, may be set per device */
+	INDEX_HASHTABLE_BITS = 13, /* Default, may be set per device */
+	MIN_HASHTABLE_BITS = 4,
+	MAX_PEER_HASHTABLE_BITS = 20,
+	MAX_INDEX_HASHTABLE_BITS = 22
 };
 
 enum message_type {
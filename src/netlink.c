@@ -8,6 +8,7 @@
 #include "peer.h"
 #include "socket.h"
 #include "queueing.h"
+#include "timers.h"
 #include "messages.h"
 #include "uapi/wireguard.h"
 #include <linux/if.h>
@@ -17,6 +18,8 @@
 
 static struct genl_family genl_family;
 
+enum { WG_MCGRP_PEERS };
+
 static const struct nla_policy device_policy[WGDEVICE_A_MAX + 1] = {
 	[WGDEVICE_A_IFINDEX]		= { .type = NLA_U32 },
 	[WGDEVICE_A_IFNAME]		= { .type = NLA_NUL_STRING, .len = IFNAMSIZ - 1 },
@@ -25,7 +28,20 @@ static const struct nla_policy device_policy[WGDEVICE_A_MAX + 1] = {
 	[WGDEVICE_A_FLAGS]		= { .type = NLA_U32 },
 	[WGDEVICE_A_LISTEN_PORT]	= { .type = NLA_U16 },
 	[WGDEVICE_A_FWMARK]		= { .type = NLA_U32 },
-	[WGDEVICE_A_PEERS]		= { .type = NLA_NESTED }
+	[WGDEVICE_A_PEERS]		= { .type = NLA_NESTED },
+	[WGDEVICE_A_GENERATION]		= { .type = NLA_U64 },
+	[WGDEVICE_A_SINCE_GENERATION]	= { .type = NLA_U64 },
+	[WGDEVICE_A_LINK_INFO]		= { .type = NLA_NESTED },
+	[WGDEVICE_A_BRING_UP_SPREAD]	= { .type = NLA_U32 },
+	[WGDEVICE_A_BRING_UP_PENDING]	= { .type = NLA_U32 },
+	[WGDEVICE_A_BRING_UP_TIME]	= { .type = NLA_U64 },
+	[WGDEVICE_A_LISTEN_PORT_COUNT]	= { .type = NLA_U16 },
+	[WGDEVICE_A_LATENCY_STATS]	= { .type = NLA_U8 },
+	[WGDEVICE_A_LATENCY]		= { .type = NLA_NESTED },
+	[WGDEVICE_A_DROPS]		= { .type = NLA_NESTED },
+	[WGDEVICE_A_ENCRYPT_QUEUE]	= { .type = NLA_NESTED },
+	[WGDEVICE_A_DECRYPT_QUEUE]	= { .type = NLA_NESTED },
+	[WGDEVICE_A_HANDSHAKE_QUEUE]	= { .type = NLA_NESTED }
 };
 
 static const struct nla_policy peer_policy[WGPEER_A_MAX + 1] = {
@@ -38,7 +54,17 @@ static const struct nla_policy peer_policy[WGPEER_A_MAX + 1] = {
 	[WGPEER_A_RX_BYTES]				= { .type = NLA_U64 },
 	[WGPEER_A_TX_BYTES]				= { .type = NLA_U64 },
 	[WGPEER_A_ALLOWEDIPS]				= { .type = NLA_NESTED },
-	[WGPEER_A_PROTOCOL_VERSION]			= { .type = NLA_U32 }
+	[WGPEER_A_PROTOCOL_VERSION]			= { .type = NLA_U32 },
+	[WGPEER_A_GENERATION]				= { .type = NLA_U64 },
+	[WGPEER_A_EVENTS]				= { .type = NLA_U32 },
+	[WGPEER_A_ENDPOINT_PORT_COUNT]			= { .type = NLA_U16 },
+	[WGPEER_A_ENDPOINT_CACHE_HITS]			= { .type = NLA_U64 },
+	[WGPEER_A_ENDPOINT_CACHE_MISSES]		= { .type = NLA_U64 },
+	[WGPEER_A_ENDPOINT_ROAMS]			= { .type = NLA_U64 },
+	[WGPEER_A_TX_QUEUE_LEN]				= { .type = NLA_U32 },
+	[WGPEER_A_TX_QUEUE_PEAK]			= { .type = NLA_U32 },
+	[WGPEER_A_RX_QUEUE_LEN]				= { .type = NLA_U32 },
+	[WGPEER_A_RX_QUEUE_PEAK]			= { .type = NLA_U32 }
 };
 
 static const struct nla_policy allowedip_policy[WGALLOWEDIP_A_MAX + 1] = {
@@ -96,9 +122,84 @@ struct dump_ctx {
 	struct wg_peer *next_peer;
 	u64 allowedips_seq;
 	struct allowedips_node *next_allowedip;
+	u64 generation, since_generation;
+	u8 (*keys)[NOISE_PUBLIC_KEY_LEN];
+	unsigned int num_keys, next_key;
+	u32 flags;
+	bool sent_header;
+	unsigned int next_queue;
+	int next_worker;
 };
 
-#define DUMP_CTX(cb) ((struct dump_ctx *)(cb)->args)
+/* The dump context is allocated, rather than living in cb->args directly, as
+ * it no longer fits there on 32-bit platforms.
+ */
+#define DUMP_CTX(cb) ((struct dump_ctx *)(cb)->args[0])
+
+static int get_peer_stats(struct wg_peer *peer, struct sk_buff *skb)
+{
+	const struct __kernel_timespec last_handshake = {
+		.tv_sec = peer->walltime_last_handshake.tv_sec,
+		.tv_nsec = peer->walltime_last_handshake.tv_nsec
+	};
+	u64 cache_hits, cache_misses;
+	struct endpoint endpoint;
+	bool fail = false;
+	int cpu;
+
+	read_lock_bh(&peer->endpoint_lock);
+	endpoint = peer->endpoint;
+	cache_hits = peer->endpoint_cache_hits;
+	cache_misses = peer->endpoint_cache_misses;
+	if (peer->endpoint_cache) {
+		for_each_possible_cpu(cpu) {
+			const struct endpoint_cache_stats *stats =
+				per_cpu_ptr(peer->endpoint_cache->stats, cpu);
+
+			cache_hits += READ_ONCE(stats->hits);
+			cache_misses += READ_ONCE(stats->misses);
+		}
+	}
+	read_unlock_bh(&peer->endpoint_lock);
+
+	if (nla_put(skb, WGPEER_A_LAST_HANDSHAKE_TIME, sizeof(last_handshake),
+		    &last_handshake) ||
+	    nla_put_u16(skb, WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL,
+			peer->persistent_keepalive_interval) ||
+	    nla_put_u64_64bit(skb, WGPEER_A_TX_BYTES, peer->tx_bytes,
+			      WGPEER_A_UNSPEC) ||
+	    nla_put_u64_64bit(skb, WGPEER_A_RX_BYTES, peer->rx_bytes,
+			      WGPEER_A_UNSPEC) ||
+	    nla_put_u64_64bit(skb, WGPEER_A_ENDPOINT_CACHE_HITS, cache_hits,
+			      WGPEER_A_UNSPEC) ||
+	    nla_put_u64_64bit(skb, WGPEER_A_ENDPOINT_CACHE_MISSES, cache_misses,
+			      WGPEER_A_UNSPEC) ||
+	    nla_put_u64_64bit(skb, WGPEER_A_ENDPOINT_ROAMS,
+			      READ_ONCE(peer->endpoint_roams), WGPEER_A_UNSPEC) ||
+	    nla_put_u32(skb, WGPEER_A_TX_QUEUE_LEN,
+			atomic_read(&peer->tx_queue.count)) ||
+	    nla_put_u32(skb, WGPEER_A_TX_QUEUE_PEAK,
+			READ_ONCE(peer->tx_queue.peak)) ||
+	    nla_put_u32(skb, WGPEER_A_RX_QUEUE_LEN,
+			atomic_read(&peer->rx_queue.count)) ||
+	    nla_put_u32(skb, WGPEER_A_RX_QUEUE_PEAK,
+			READ_ONCE(peer->rx_queue.peak)) ||
+	    nla_put_u32(skb, WGPEER_A_PROTOCOL_VERSION, 1) ||
+	    nla_put_u64_64bit(skb, WGPEER_A_GENERATION,
+			      atomic64_read(&peer->generation), WGPEER_A_UNSPEC))
+		return -EMSGSIZE;
+
+	if (endpoint.addr.sa_family == AF_INET)
+		fail = nla_put(skb, WGPEER_A_ENDPOINT, sizeof(endpoint.addr4),
+			       &endpoint.addr4);
+	else if (endpoint.addr.sa_family == AF_INET6)
+		fail = nla_put(skb, WGPEER_A_ENDPOINT, sizeof(endpoint.addr6),
+			       &endpoint.addr6);
+	if (!fail && endpoint.port_count > 1)
+		fail = nla_put_u16(skb, WGPEER_A_ENDPOINT_PORT_COUNT,
+				   endpoint.port_count);
+	return fail ? -EMSGSIZE : 0;
+}
 
 static int
 get_peer(struct wg_peer *peer, struct sk_buff *skb, struct dump_ctx *ctx)
@@ -119,11 +220,6 @@ get_peer(struct wg_peer *peer, struct sk_buff *skb, struct dump_ctx *ctx)
 		goto err;
 
 	if (!allowedips_node) {
-		const struct __kernel_timespec last_handshake = {
-			.tv_sec = peer->walltime_last_handshake.tv_sec,
-			.tv_nsec = peer->walltime_last_handshake.tv_nsec
-		};
-
 		down_read(&peer->handshake.lock);
 		fail = nla_put(skb, WGPEER_A_PRESHARED_KEY,
 			       NOISE_SYMMETRIC_KEY_LEN,
@@ -132,28 +228,7 @@ get_peer(struct wg_peer *peer, struct sk_buff *skb, struct dump_ctx *ctx)
 		if (fail)
 			goto err;
 
-		if (nla_put(skb, WGPEER_A_LAST_HANDSHAKE_TIME,
-			    sizeof(last_handshake), &last_handshake) ||
-		    nla_put_u16(skb, WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL,
-				peer->persistent_keepalive_interval) ||
-		    nla_put_u64_64bit(skb, WGPEER_A_TX_BYTES, peer->tx_bytes,
-				      WGPEER_A_UNSPEC) ||
-		    nla_put_u64_64bit(skb, WGPEER_A_RX_BYTES, peer->rx_bytes,
-				      WGPEER_A_UNSPEC) ||
-		    nla_put_u32(skb, WGPEER_A_PROTOCOL_VERSION, 1))
-			goto err;
-
-		read_lock_bh(&peer->endpoint_lock);
-		if (peer->endpoint.addr.sa_family == AF_INET)
-			fail = nla_put(skb, WGPEER_A_ENDPOINT,
-				       sizeof(peer->endpoint.addr4),
-				       &peer->endpoint.addr4);
-		else if (peer->endpoint.addr.sa_family == AF_INET6)
-			fail = nla_put(skb, WGPEER_A_ENDPOINT,
-				       sizeof(peer->endpoint.addr6),
-				       &peer->endpoint.addr6);
-		read_unlock_bh(&peer->endpoint_lock);
-		if (fail)
+		if (get_peer_stats(peer, skb))
 			goto err;
 		allowedips_node =
 			list_first_entry_or_null(&peer->allowedips_list,
@@ -194,15 +269,443 @@ err:
 	return -EMSGSIZE;
 }
 
+static int get_peer_stats_only(struct wg_peer *peer, struct sk_buff *skb)
+{
+	struct nlattr *peer_nest = nla_nest_start(skb, 0);
+
+	if (!peer_nest)
+		return -EMSGSIZE;
+	if (nla_put(skb, WGPEER_A_PUBLIC_KEY, NOISE_PUBLIC_KEY_LEN,
+		    peer->handshake.remote_static) ||
+	    get_peer_stats(peer, skb)) {
+		nla_nest_cancel(skb, peer_nest);
+		return -EMSGSIZE;
+	}
+	nla_nest_end(skb, peer_nest);
+	return 0;
+}
+
+static bool peer_is_wanted(const struct dump_ctx *ctx, struct wg_peer *peer)
+{
+	return !ctx->since_generation ||
+	       atomic64_read(&peer->generation) > ctx->since_generation;
+}
+
+static int put_generations(struct sk_buff *skb, const struct dump_ctx *ctx)
+{
+	if (nla_put_u64_64bit(skb, WGDEVICE_A_GENERATION, ctx->generation,
+			      WGDEVICE_A_UNSPEC))
+		return -EMSGSIZE;
+	if (ctx->since_generation &&
+	    nla_put_u64_64bit(skb, WGDEVICE_A_SINCE_GENERATION,
+			      ctx->since_generation, WGDEVICE_A_UNSPEC))
+		return -EMSGSIZE;
+	return 0;
+}
+
+static int get_link_info(struct sk_buff *skb, const struct wg_device *wg)
+{
+	struct nlattr *nest = nla_nest_start(skb, WGDEVICE_A_LINK_INFO);
+
+	if (!nest)
+		return -EMSGSIZE;
+	if (wg_device_fill_link_info(skb, wg->dev)) {
+		nla_nest_cancel(skb, nest);
+		return -EMSGSIZE;
+	}
+	nla_nest_end(skb, nest);
+	return 0;
+}
+
+static int get_bring_up(struct sk_buff *skb, const struct wg_device *wg)
+{
+	if (nla_put_u32(skb, WGDEVICE_A_BRING_UP_SPREAD,
+			READ_ONCE(wg->bring_up_spread)) ||
+	    nla_put_u32(skb, WGDEVICE_A_BRING_UP_PENDING,
+			max(atomic_read(&wg->bring_up_pending), 0)) ||
+	    nla_put_u64_64bit(skb, WGDEVICE_A_BRING_UP_TIME,
+			      READ_ONCE(wg->bring_up_time), WGDEVICE_A_UNSPEC))
+		return -EMSGSIZE;
+	return 0;
+}
+
+static int get_latency(struct sk_buff *skb, const struct wg_device *wg)
+{
+	struct wg_latency_hist __percpu *hist = READ_ONCE(wg->latency_hist);
+	u64 buckets[WGLATENCY_BUCKETS];
+	struct nlattr *nest, *stage_nest;
+	unsigned int stage, i;
+	int cpu;
+
+	if (nla_put_u8(skb, WGDEVICE_A_LATENCY_STATS,
+		       READ_ONCE(wg->latency_stats)))
+		return -EMSGSIZE;
+	if (!hist)
+		return 0;
+
+	nest = nla_nest_start(skb, WGDEVICE_A_LATENCY);
+	if (!nest)
+		return -EMSGSIZE;
+	for (stage = 0; stage < __WGLATENCY_STAGE_COUNT; ++stage) {
+		memset(buckets, 0, sizeof(buckets));
+		for_each_possible_cpu(cpu) {
+			const u64 *counts = per_cpu_ptr(hist, cpu)->buckets[stage];
+
+			for (i = 0; i < WGLATENCY_BUCKETS; ++i)
+				buckets[i] += READ_ONCE(counts[i]);
+		}
+		stage_nest = nla_nest_start(skb, 0);
+		if (!stage_nest)
+			goto err;
+		if (nla_put_u32(skb, WGLATENCY_A_STAGE, stage) ||
+		    nla_put(skb, WGLATENCY_A_BUCKETS, sizeof(buckets), buckets)) {
+			nla_nest_cancel(skb, stage_nest);
+			goto err;
+		}
+		nla_nest_end(skb, stage_nest);
+	}
+	nla_nest_end(skb, nest);
+	return 0;
+
+err:
+	nla_nest_cancel(skb, nest);
+	return -EMSGSIZE;
+}
+
+static int get_drops(struct sk_buff *skb, const struct wg_device *wg)
+{
+	unsigned int reason;
+	struct nlattr *nest;
+	u64 count;
+	int cpu;
+
+	nest = nla_nest_start(skb, WGDEVICE_A_DROPS);
+	if (!nest)
+		return -EMSGSIZE;
+	for (reason = 1; reason < __WGDROP_LAST; ++reason) {
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += READ_ONCE(per_cpu_ptr(wg->drops, cpu)->count[reason]);
+		if (nla_put_u64_64bit(skb, reason, count, WGDROP_UNSPEC)) {
+			nla_nest_cancel(skb, nest);
+			return -EMSGSIZE;
+		}
+	}
+	nla_nest_end(skb, nest);
+	return 0;
+}
+
+/* Workers from *next_cpu onwards are added, and if they don't all fit, those
+ * that did are kept, and *next_cpu is left at the first that didn't.
+ */
+static int get_workers(struct sk_buff *skb, struct crypt_queue *queue,
+		       int *next_cpu)
+{
+	struct nlattr *nest, *worker_nest;
+	u64 busy_time;
+	int cpu;
+
+	nest = nla_nest_start(skb, WGQUEUE_A_WORKERS);
+	if (!nest)
+		return -EMSGSIZE;
+	for_each_possible_cpu(cpu) {
+		if (cpu < *next_cpu)
+			continue;
+		busy_time = READ_ONCE(per_cpu_ptr(queue->worker, cpu)->busy_time);
+		if (!busy_time)
+			continue;
+		worker_nest = nla_nest_start(skb, 0);
+		if (!worker_nest)
+			goto err;
+		if (nla_put_u32(skb, WGWORKER_A_CPU, cpu) ||
+		    nla_put_u64_64bit(skb, WGWORKER_A_BUSY_TIME, busy_time,
+				      WGWORKER_A_UNSPEC)) {
+			nla_nest_cancel(skb, worker_nest);
+			goto err;
+		}
+		nla_nest_end(skb, worker_nest);
+	}
+	nla_nest_end(skb, nest);
+	return 0;
+
+err:
+	nla_nest_end(skb, nest);
+	*next_cpu = cpu;
+	return -EMSGSIZE;
+}
+
+static int get_queue(struct sk_buff *skb, int attr, struct crypt_queue *queue,
+		     unsigned int len)
+{
+	struct nlattr *nest;
+	u64 busy_time = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		busy_time += READ_ONCE(per_cpu_ptr(queue->worker, cpu)->busy_time);
+
+	nest = nla_nest_start(skb, attr);
+	if (!nest)
+		return -EMSGSIZE;
+	if (nla_put_u32(skb, WGQUEUE_A_LEN, len) ||
+	    nla_put_u32(skb, WGQUEUE_A_PEAK, READ_ONCE(queue->peak)) ||
+	    nla_put_u32(skb, WGQUEUE_A_LIMIT, queue->ring.size) ||
+	    nla_put_u64_64bit(skb, WGQUEUE_A_BUSY_TIME, busy_time,
+			      WGQUEUE_A_UNSPEC)) {
+		nla_nest_cancel(skb, nest);
+		return -EMSGSIZE;
+	}
+	nla_nest_end(skb, nest);
+	return 0;
+}
+
+static int get_queues(struct sk_buff *skb, struct wg_device *wg)
+{
+	if (get_queue(skb, WGDEVICE_A_ENCRYPT_QUEUE, &wg->encrypt_queue,
+		      wg_packet_queue_len(&wg->encrypt_queue)) ||
+	    get_queue(skb, WGDEVICE_A_DECRYPT_QUEUE, &wg->decrypt_queue,
+		      wg_packet_queue_len(&wg->decrypt_queue)) ||
+	    get_queue(skb, WGDEVICE_A_HANDSHAKE_QUEUE, &wg->handshake_queue,
+		      atomic_read(&wg->handshake_queue_len)))
+		return -EMSGSIZE;
+	return 0;
+}
+
+/* The per-CPU breakdown of each queue grows with the number of CPUs, so it
+ * follows the device's header in nests of its own, with ctx->next_queue and
+ * ctx->next_worker as the cursor, which may span several messages.
+ */
+static int get_queue_workers(struct sk_buff *skb, struct dump_ctx *ctx)
+{
+	static const int attrs[] = { WGDEVICE_A_ENCRYPT_QUEUE,
+				     WGDEVICE_A_DECRYPT_QUEUE,
+				     WGDEVICE_A_HANDSHAKE_QUEUE };
+	struct crypt_queue *queues[] = { &ctx->wg->encrypt_queue,
+					 &ctx->wg->decrypt_queue,
+					 &ctx->wg->handshake_queue };
+	struct nlattr *nest;
+	int ret;
+
+	for (; ctx->next_queue < ARRAY_SIZE(attrs);
+	     ++ctx->next_queue, ctx->next_worker = 0) {
+		nest = nla_nest_start(skb, attrs[ctx->next_queue]);
+		if (!nest)
+			return -EMSGSIZE;
+		ret = get_workers(skb, queues[ctx->next_queue],
+				  &ctx->next_worker);
+		nla_nest_end(skb, nest);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Rather than walking the whole peer list, only the peers requested by public
+ * key are looked up in the hashtable, with ctx->next_key as the cursor. Keys
+ * that don't belong to any peer are skipped.
+ */
+static int get_requested_peers(struct sk_buff *skb, struct dump_ctx *ctx)
+{
+	struct wg_peer *peer;
+	int ret;
+
+	for (; ctx->next_key < ctx->num_keys; ++ctx->next_key) {
+		peer = wg_pubkey_hashtable_lookup(ctx->wg->peer_hashtable,
+						  ctx->keys[ctx->next_key]);
+		if (!peer || !peer_is_wanted(ctx, peer)) {
+			wg_peer_put(peer);
+			/* An allowed IP cursor can only have been left by the
+			 * peer of this key, which is now gone.
+			 */
+			ctx->next_allowedip = NULL;
+			ctx->allowedips_seq = 0;
+			continue;
+		}
+		if (ctx->flags & WGDEVICE_DUMP_F_STATS_ONLY)
+			ret = get_peer_stats_only(peer, skb);
+		else
+			ret = get_peer(peer, skb, ctx);
+		wg_peer_put(peer);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int parse_requested_peers(struct dump_ctx *ctx, struct nlattr *peers)
+{
+	struct nlattr *attr, *peer[WGPEER_A_MAX + 1];
+	unsigned int count = 0;
+	int rem, ret;
+
+	nla_for_each_nested(attr, peers, rem)
+		++count;
+	ctx->keys = kmalloc_array(count, sizeof(*ctx->keys), GFP_KERNEL);
+	if (!ctx->keys)
+		return -ENOMEM;
+	nla_for_each_nested(attr, peers, rem) {
+		ret = nla_parse_nested(peer, WGPEER_A_MAX, attr, peer_policy,
+				       NULL);
+		if (ret < 0)
+			return ret;
+		if (!peer[WGPEER_A_PUBLIC_KEY])
+			return -EINVAL;
+		memcpy(ctx->keys[ctx->num_keys++],
+		       nla_data(peer[WGPEER_A_PUBLIC_KEY]), NOISE_PUBLIC_KEY_LEN);
+	}
+	return 0;
+}
+
 static int wg_get_device_start(struct netlink_callback *cb)
 {
+	struct nlattr **attrs = genl_dumpit_info(cb)->attrs;
+	struct dump_ctx *ctx;
 	struct wg_device *wg;
+	u32 flags = 0;
+	int ret;
 
-	wg = lookup_interface(genl_dumpit_info(cb)->attrs, cb->skb);
-	if (IS_ERR(wg))
-		return PTR_ERR(wg);
-	DUMP_CTX(cb)->wg = wg;
+	if (attrs[WGDEVICE_A_FLAGS])
+		flags = nla_get_u32(attrs[WGDEVICE_A_FLAGS]);
+	if (flags & ~__WGDEVICE_DUMP_F_ALL)
+		return -EOPNOTSUPP;
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	wg = lookup_interface(attrs, cb->skb);
+	if (IS_ERR(wg)) {
+		ret = PTR_ERR(wg);
+		goto err_free;
+	}
+	if (attrs[WGDEVICE_A_PEERS]) {
+		ret = parse_requested_peers(ctx, attrs[WGDEVICE_A_PEERS]);
+		if (ret)
+			goto err_put;
+	}
+	ctx->wg = wg;
+	ctx->flags = flags;
+	/* This is sampled before walking any peers, so that changes made during
+	 * the dump are included in the next one, even if they are in this one.
+	 */
+	ctx->generation = atomic64_read(&wg->peer_generation);
+	if (attrs[WGDEVICE_A_SINCE_GENERATION]) {
+		u64 since = nla_get_u64(attrs[WGDEVICE_A_SINCE_GENERATION]);
+
+		if (since <= ctx->generation &&
+		    since >= atomic64_read(&wg->peer_removal_generation))
+			ctx->since_generation = since;
+	}
+	cb->args[0] = (long)ctx;
 	return 0;
+
+err_put:
+	dev_put(wg->dev);
+	kfree(ctx->keys);
+err_free:
+	kfree(ctx);
+	return ret;
+}
+
+/* This is the same as below, except that only statistics are dumped, so it
+ * can walk the peer list under RCU, without the RTNL or device_update_lock,
+ * and never needs to split a peer across messages. Public keys of peers are
+ * immutable, so they can be read without the handshake lock. The device name,
+ * on the other hand, can be changed under the RTNL at any time, so only the
+ * ifindex is sent.
+ */
+static int get_device_stats_dump(struct sk_buff *skb,
+				 struct netlink_callback *cb)
+{
+	struct wg_peer *peer, *next_peer_cursor;
+	struct dump_ctx *ctx = DUMP_CTX(cb);
+	struct wg_device *wg = ctx->wg;
+	struct nlattr *peers_nest;
+	int ret = -EMSGSIZE;
+	bool done = true;
+	void *hdr;
+
+	rcu_read_lock_bh();
+	cb->seq = READ_ONCE(wg->device_update_gen);
+	next_peer_cursor = ctx->next_peer;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			  &genl_family, NLM_F_MULTI, WG_CMD_GET_DEVICE);
+	if (!hdr)
+		goto out;
+	genl_dump_check_consistent(cb, hdr);
+
+	if (!ctx->sent_header) {
+		if (nla_put_u16(skb, WGDEVICE_A_LISTEN_PORT,
+				READ_ONCE(wg->incoming_port)) ||
+		    nla_put_u16(skb, WGDEVICE_A_LISTEN_PORT_COUNT,
+				READ_ONCE(wg->listen_port_count)) ||
+		    nla_put_u32(skb, WGDEVICE_A_FWMARK, READ_ONCE(wg->fwmark)) ||
+		    nla_put_u32(skb, WGDEVICE_A_IFINDEX, wg->dev->ifindex) ||
+		    put_generations(skb, ctx) || get_link_info(skb, wg) ||
+		    get_bring_up(skb, wg) || get_latency(skb, wg) ||
+		    get_drops(skb, wg) || get_queues(skb, wg))
+			goto out;
+	}
+
+	ret = 0;
+	/* Peers only start once all of the workers are out. */
+	if (get_queue_workers(skb, ctx)) {
+		done = false;
+		goto out;
+	}
+
+	peers_nest = nla_nest_start(skb, WGDEVICE_A_PEERS);
+	if (!peers_nest) {
+		done = false;
+		goto out;
+	}
+	if (ctx->keys) {
+		done = !get_requested_peers(skb, ctx);
+		nla_nest_end(skb, peers_nest);
+		goto out;
+	}
+	/* A removed cursor might point anywhere by now, so we treat it the same
+	 * as there being no more peers left, just like below.
+	 */
+	if (ctx->next_peer && READ_ONCE(ctx->next_peer->is_dead)) {
+		nla_nest_cancel(skb, peers_nest);
+		goto out;
+	}
+	peer = list_prepare_entry(ctx->next_peer, &wg->peer_list, peer_list);
+	list_for_each_entry_continue_rcu(peer, &wg->peer_list, peer_list) {
+		if (!peer_is_wanted(ctx, peer)) {
+			next_peer_cursor = peer;
+			continue;
+		}
+		if (get_peer_stats_only(peer, skb)) {
+			done = false;
+			break;
+		}
+		next_peer_cursor = peer;
+	}
+	nla_nest_end(skb, peers_nest);
+
+out:
+	/* If the cursor is concurrently being freed, it is also being removed,
+	 * which changes the generation, so userspace will retry anyway.
+	 */
+	if (!ret && !done && next_peer_cursor &&
+	    !wg_peer_get_maybe_zero(next_peer_cursor))
+		done = true;
+	rcu_read_unlock_bh();
+	wg_peer_put(ctx->next_peer);
+
+	if (ret) {
+		genlmsg_cancel(skb, hdr);
+		return ret;
+	}
+	genlmsg_end(skb, hdr);
+	ctx->sent_header = true;
+	if (done) {
+		ctx->next_peer = NULL;
+		return 0;
+	}
+	ctx->next_peer = next_peer_cursor;
+	return skb->len;
 }
 
 static int wg_get_device_dump(struct sk_buff *skb, struct netlink_callback *cb)
@@ -215,6 +718,9 @@ static int wg_get_device_dump(struct sk_buff *skb, struct netlink_callback *cb)
 	bool done = true;
 	void *hdr;
 
+	if (ctx->flags & WGDEVICE_DUMP_F_STATS_ONLY)
+		return get_device_stats_dump(skb, cb);
+
 	rtnl_lock();
 	mutex_lock(&wg->device_update_lock);
 	cb->seq = wg->device_update_gen;
@@ -226,12 +732,17 @@ static int wg_get_device_dump(struct sk_buff *skb, struct netlink_callback *cb)
 		goto out;
 	genl_dump_check_consistent(cb, hdr);
 
-	if (!ctx->next_peer) {
+	if (!ctx->sent_header) {
 		if (nla_put_u16(skb, WGDEVICE_A_LISTEN_PORT,
 				wg->incoming_port) ||
+		    nla_put_u16(skb, WGDEVICE_A_LISTEN_PORT_COUNT,
+				wg->listen_port_count) ||
 		    nla_put_u32(skb, WGDEVICE_A_FWMARK, wg->fwmark) ||
 		    nla_put_u32(skb, WGDEVICE_A_IFINDEX, wg->dev->ifindex) ||
-		    nla_put_string(skb, WGDEVICE_A_IFNAME, wg->dev->name))
+		    nla_put_string(skb, WGDEVICE_A_IFNAME, wg->dev->name) ||
+		    put_generations(skb, ctx) || get_link_info(skb, wg) ||
+		    get_bring_up(skb, wg) || get_latency(skb, wg) ||
+		    get_drops(skb, wg))
 			goto out;
 
 		down_read(&wg->static_identity.lock);
@@ -253,20 +764,25 @@ static int wg_get_device_dump(struct sk_buff *skb, struct netlink_callback *cb)
 	if (!peers_nest)
 		goto out;
 	ret = 0;
-	/* If the last cursor was removed via list_del_init in peer_remove, then
-	 * we just treat this the same as there being no more peers left. The
-	 * reason is that seq_nr should indicate to userspace that this isn't a
-	 * coherent dump anyway, so they'll try again.
+	if (ctx->keys) {
+		done = !get_requested_peers(skb, ctx);
+		nla_nest_end(skb, peers_nest);
+		goto out;
+	}
+	/* If the last cursor was removed via peer_make_dead, then we just
+	 * treat this the same as there being no more peers left. The reason is
+	 * that seq_nr should indicate to userspace that this isn't a coherent
+	 * dump anyway, so they'll try again.
 	 */
 	if (list_empty(&wg->peer_list) ||
-	    (ctx->next_peer && list_empty(&ctx->next_peer->peer_list))) {
+	    (ctx->next_peer && ctx->next_peer->is_dead)) {
 		nla_nest_cancel(skb, peers_nest);
 		goto out;
 	}
 	lockdep_assert_held(&wg->device_update_lock);
 	peer = list_prepare_entry(ctx->next_peer, &wg->peer_list, peer_list);
 	list_for_each_entry_continue(peer, &wg->peer_list, peer_list) {
-		if (get_peer(peer, skb, ctx)) {
+		if (peer_is_wanted(ctx, peer) && get_peer(peer, skb, ctx)) {
 			done = false;
 			break;
 		}
@@ -286,6 +802,7 @@ out:
 		return ret;
 	}
 	genlmsg_end(skb, hdr);
+	ctx->sent_header = true;
 	if (done) {
 		ctx->next_peer = NULL;
 		return 0;
@@ -303,25 +820,48 @@ static int wg_get_device_done(struct netlink_callback *cb)
 {
 	struct dump_ctx *ctx = DUMP_CTX(cb);
 
-	if (ctx->wg)
-		dev_put(ctx->wg->dev);
+	if (!ctx)
+		return 0;
+	dev_put(ctx->wg->dev);
 	wg_peer_put(ctx->next_peer);
+	kfree(ctx->keys);
+	kfree(ctx);
 	return 0;
 }
 
-static int set_port(struct wg_device *wg, u16 port)
+static int set_port(struct wg_device *wg, u16 port, u16 count)
 {
+	u16 old_port = wg->incoming_port, old_count = wg->sock_count;
+	bool released = false;
 	struct wg_peer *peer;
+	int ret;
 
-	if (wg->incoming_port == port)
+	if (wg->incoming_port == port && wg->listen_port_count == count)
 		return 0;
 	list_for_each_entry(peer, &wg->peer_list, peer_list)
 		wg_socket_clear_peer_endpoint_src(peer);
 	if (!netif_running(wg->dev)) {
 		wg->incoming_port = port;
+		wg->listen_port_count = count;
 		return 0;
 	}
-	return wg_socket_init(wg, port);
+	/* The new range can only be bound once the old one, if it overlaps, is
+	 * released, in which case the old one is bound again on failure.
+	 */
+	if (port && port < old_port + old_count && old_port < port + count) {
+		wg_socket_reinit(wg, NULL, NULL, 0);
+		released = true;
+	}
+	ret = wg_socket_init(wg, port, count);
+	if (ret) {
+		if (released && wg_socket_init(wg, old_port, old_count))
+			pr_err("%s: Could not rebind ports %u-%u\n",
+			       wg->dev->name, old_port,
+			       old_port + old_count - 1);
+		return ret;
+	}
+	wg->listen_port_count = count;
+	return 0;
 }
 
 static int set_allowedip(struct wg_peer *peer, struct nlattr **attrs)
@@ -352,10 +892,111 @@ static int set_allowedip(struct wg_peer *peer, struct nlattr **attrs)
 	return ret;
 }
 
-static int set_peer(struct wg_device *wg, struct nlattr **attrs)
+/* When a single message adds many peers, they are allocated up front, and
+ * their keys are precomputed together in parallel, before set_peer() reaches
+ * each and publishes it, already complete. The peers are kept by the position
+ * of their attribute in the message, and those left over are freed.
+ */
+struct set_peers_batch {
+	struct wg_peer **new_peers;
+	unsigned int len, next;
+};
+
+static struct set_peers_batch *set_peers_batch_alloc(struct wg_device *wg,
+						     struct nlattr *peers)
+{
+	struct nlattr *attr, *peer[WGPEER_A_MAX + 1];
+	struct wg_peer **new_peers, *new_peer;
+	unsigned int count = 0, num_new = 0;
+	struct set_peers_batch *batch;
+	u8 *preshared_key;
+	u32 flags;
+	int rem;
+
+	nla_for_each_nested(attr, peers, rem)
+		++count;
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return NULL;
+	batch->new_peers = kvcalloc(count, sizeof(*batch->new_peers),
+				    GFP_KERNEL);
+	new_peers = kvmalloc_array(count, sizeof(*new_peers), GFP_KERNEL);
+	if (!batch->new_peers || !new_peers) {
+		kvfree(batch->new_peers);
+		kvfree(new_peers);
+		kfree(batch);
+		return NULL;
+	}
+
+	down_read(&wg->static_identity.lock);
+	nla_for_each_nested(attr, peers, rem) {
+		/* set_peer() will fail at the same place, and stop there. */
+		if (nla_parse_nested(peer, WGPEER_A_MAX, attr, peer_policy,
+				     NULL) < 0)
+			break;
+		++batch->len;
+
+		/* Anything that turns out not to be new is dealt with, and
+		 * its prepared peer freed, by set_peer().
+		 */
+		flags = peer[WGPEER_A_FLAGS] ?
+			nla_get_u32(peer[WGPEER_A_FLAGS]) : 0;
+		if (!peer[WGPEER_A_PUBLIC_KEY] ||
+		    nla_len(peer[WGPEER_A_PUBLIC_KEY]) != NOISE_PUBLIC_KEY_LEN ||
+		    (flags & (WGPEER_F_REMOVE_ME | WGPEER_F_UPDATE_ONLY)))
+			continue;
+		new_peer = wg_pubkey_hashtable_lookup(wg->peer_hashtable,
+					nla_data(peer[WGPEER_A_PUBLIC_KEY]));
+		wg_peer_put(new_peer);
+		if (new_peer)
+			continue;
+
+		preshared_key = NULL;
+		if (peer[WGPEER_A_PRESHARED_KEY] &&
+		    nla_len(peer[WGPEER_A_PRESHARED_KEY]) ==
+		    NOISE_SYMMETRIC_KEY_LEN)
+			preshared_key = nla_data(peer[WGPEER_A_PRESHARED_KEY]);
+		new_peer = wg_peer_alloc(wg, nla_data(peer[WGPEER_A_PUBLIC_KEY]),
+					 preshared_key);
+		if (IS_ERR(new_peer))
+			continue;
+		batch->new_peers[batch->len - 1] = new_peer;
+		new_peers[num_new++] = new_peer;
+	}
+	wg_peer_for_each_parallel(wg, new_peers, num_new,
+				  wg_peer_precompute_keys);
+	up_read(&wg->static_identity.lock);
+	kvfree(new_peers);
+	return batch;
+}
+
+/* Takes the peer prepared for the next attribute, if any. */
+static struct wg_peer *set_peers_batch_take(struct set_peers_batch *batch)
+{
+	struct wg_peer *peer;
+
+	if (!batch || batch->next >= batch->len)
+		return NULL;
+	peer = batch->new_peers[batch->next];
+	batch->new_peers[batch->next++] = NULL;
+	return peer;
+}
+
+static void set_peers_batch_free(struct set_peers_batch *batch)
 {
+	unsigned int i;
+
+	for (i = 0; i < batch->len; ++i)
+		wg_peer_put(batch->new_peers[i]);
+	kvfree(batch->new_peers);
+	kfree(batch);
+}
+
+static int set_peer(struct wg_device *wg, struct nlattr **attrs,
+		    struct set_peers_batch *batch, struct list_head *dead_peers)
+{
+	struct wg_peer *peer = NULL, *new_peer = set_peers_batch_take(batch);
 	u8 *public_key = NULL, *preshared_key = NULL;
-	struct wg_peer *peer = NULL;
 	u32 flags = 0;
 	int ret;
 
@@ -407,11 +1048,19 @@ static int set_peer(struct wg_device *wg, struct nlattr **attrs)
 		}
 		up_read(&wg->static_identity.lock);
 
-		peer = wg_peer_create(wg, public_key, preshared_key);
-		if (IS_ERR(peer)) {
-			ret = PTR_ERR(peer);
-			peer = NULL;
-			goto out;
+		if (new_peer) {
+			ret = wg_peer_publish(new_peer);
+			if (ret)
+				goto out;
+			peer = new_peer;
+			new_peer = NULL;
+		} else {
+			peer = wg_peer_create(wg, public_key, preshared_key);
+			if (IS_ERR(peer)) {
+				ret = PTR_ERR(peer);
+				peer = NULL;
+				goto out;
+			}
 		}
 		/* Take additional reference, as though we've just been
 		 * looked up.
@@ -420,7 +1069,8 @@ static int set_peer(struct wg_device *wg, struct nlattr **attrs)
 	}
 
 	if (flags & WGPEER_F_REMOVE_ME) {
-		wg_peer_remove(peer);
+		/* The caller finishes removing it, along with any others. */
+		wg_peer_mark_dead(peer, dead_peers);
 		goto out;
 	}
 
@@ -446,6 +1096,16 @@ static int set_peer(struct wg_device *wg, struct nlattr **attrs)
 		}
 	}
 
+	if (attrs[WGPEER_A_ENDPOINT_PORT_COUNT]) {
+		u16 count = nla_get_u16(attrs[WGPEER_A_ENDPOINT_PORT_COUNT]);
+
+		if (count > MAX_SOCKETS_PER_DEVICE) {
+			ret = -EINVAL;
+			goto out;
+		}
+		wg_socket_set_peer_endpoint_port_count(peer, count);
+	}
+
 	if (flags & WGPEER_F_REPLACE_ALLOWEDIPS)
 		wg_allowedips_remove_by_peer(&wg->peer_allowedips, peer,
 					     &wg->device_update_lock);
@@ -468,6 +1128,7 @@ static int set_peer(struct wg_device *wg, struct nlattr **attrs)
 	if (attrs[WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL]) {
 		const u16 persistent_keepalive_interval = nla_get_u16(
 				attrs[WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL]);
+
 		const bool send_keepalive =
 			!peer->persistent_keepalive_interval &&
 			persistent_keepalive_interval &&
@@ -480,8 +1141,11 @@ static int set_peer(struct wg_device *wg, struct nlattr **attrs)
 
 	if (netif_running(wg->dev))
 		wg_packet_send_staged_packets(peer);
+	wg_peer_bump_generation(peer);
 
 out:
+	/* A peer prepared for this attribute that turned out not to be new. */
+	wg_peer_put(new_peer);
 	wg_peer_put(peer);
 	if (attrs[WGPEER_A_PRESHARED_KEY])
 		memzero_explicit(nla_data(attrs[WGPEER_A_PRESHARED_KEY]),
@@ -492,6 +1156,8 @@ out:
 static int wg_set_device(struct sk_buff *skb, struct genl_info *info)
 {
 	struct wg_device *wg = lookup_interface(info->attrs, skb);
+	struct set_peers_batch *batch = NULL;
+	LIST_HEAD(dead_peers);
 	u32 flags = 0;
 	int ret;
 
@@ -509,7 +1175,9 @@ static int wg_set_device(struct sk_buff *skb, struct genl_info *info)
 	if (flags & ~__WGDEVICE_F_ALL)
 		goto out;
 
-	if (info->attrs[WGDEVICE_A_LISTEN_PORT] || info->attrs[WGDEVICE_A_FWMARK]) {
+	if (info->attrs[WGDEVICE_A_LISTEN_PORT] ||
+	    info->attrs[WGDEVICE_A_LISTEN_PORT_COUNT] ||
+	    info->attrs[WGDEVICE_A_FWMARK]) {
 		struct net *net;
 		rcu_read_lock();
 		net = rcu_dereference(wg->creating_net);
@@ -529,9 +1197,31 @@ static int wg_set_device(struct sk_buff *skb, struct genl_info *info)
 			wg_socket_clear_peer_endpoint_src(peer);
 	}
 
-	if (info->attrs[WGDEVICE_A_LISTEN_PORT]) {
-		ret = set_port(wg,
-			nla_get_u16(info->attrs[WGDEVICE_A_LISTEN_PORT]));
+	if (info->attrs[WGDEVICE_A_BRING_UP_SPREAD])
+		WRITE_ONCE(wg->bring_up_spread,
+			   nla_get_u32(info->attrs[WGDEVICE_A_BRING_UP_SPREAD]));
+
+	if (info->attrs[WGDEVICE_A_LATENCY_STATS]) {
+		ret = wg_latency_stats_set(wg,
+			nla_get_u8(info->attrs[WGDEVICE_A_LATENCY_STATS]));
+		if (ret)
+			goto out;
+	}
+
+	if (info->attrs[WGDEVICE_A_LISTEN_PORT] ||
+	    info->attrs[WGDEVICE_A_LISTEN_PORT_COUNT]) {
+		u16 port = wg->incoming_port, count = wg->listen_port_count;
+
+		if (info->attrs[WGDEVICE_A_LISTEN_PORT])
+			port = nla_get_u16(info->attrs[WGDEVICE_A_LISTEN_PORT]);
+		if (info->attrs[WGDEVICE_A_LISTEN_PORT_COUNT])
+			count = nla_get_u16(
+				info->attrs[WGDEVICE_A_LISTEN_PORT_COUNT]);
+		ret = -EINVAL;
+		if (!count || count > MAX_SOCKETS_PER_DEVICE ||
+		    (port && (u32)port + count - 1 > U16_MAX))
+			goto out;
+		ret = set_port(wg, port, count);
 		if (ret)
 			goto out;
 	}
@@ -544,7 +1234,8 @@ static int wg_set_device(struct sk_buff *skb, struct genl_info *info)
 		    NOISE_PUBLIC_KEY_LEN) {
 		u8 *private_key = nla_data(info->attrs[WGDEVICE_A_PRIVATE_KEY]);
 		u8 public_key[NOISE_PUBLIC_KEY_LEN];
-		struct wg_peer *peer, *temp;
+		struct wg_peer *peer, *temp, **peers;
+		unsigned int num_peers = 0;
 
 		if (!crypto_memneq(wg->static_identity.static_private,
 				   private_key, NOISE_PUBLIC_KEY_LEN))
@@ -562,16 +1253,29 @@ static int wg_set_device(struct sk_buff *skb, struct genl_info *info)
 			}
 		}
 
+		/* num_peers is bounded by MAX_PEERS_PER_DEVICE, so this can't
+		 * overflow. If it fails, we fall back to doing it serially.
+		 */
+		peers = kvmalloc(sizeof(*peers) * wg->num_peers, GFP_KERNEL);
+
 		down_write(&wg->static_identity.lock);
 		wg_noise_set_static_identity_private_key(&wg->static_identity,
 							 private_key);
+		if (peers) {
+			list_for_each_entry(peer, &wg->peer_list, peer_list)
+				peers[num_peers++] = peer;
+			wg_peer_for_each_parallel(wg, peers, num_peers,
+					wg_noise_precompute_static_static);
+		}
 		list_for_each_entry_safe(peer, temp, &wg->peer_list,
 					 peer_list) {
-			wg_noise_precompute_static_static(peer);
+			if (!peers)
+				wg_noise_precompute_static_static(peer);
 			wg_noise_expire_current_peer_keypairs(peer);
 		}
 		wg_cookie_checker_precompute_device_keys(&wg->cookie_checker);
 		up_write(&wg->static_identity.lock);
+		kvfree(peers);
 	}
 skip_set_private_key:
 
@@ -579,12 +1283,15 @@ skip_set_private_key:
 		struct nlattr *attr, *peer[WGPEER_A_MAX + 1];
 		int rem;
 
+		/* If this fails, peers are simply configured one by one. */
+		batch = set_peers_batch_alloc(wg, info->attrs[WGDEVICE_A_PEERS]);
+
 		nla_for_each_nested(attr, info->attrs[WGDEVICE_A_PEERS], rem) {
 			ret = nla_parse_nested(peer, WGPEER_A_MAX, attr,
 					       peer_policy, NULL);
 			if (ret < 0)
 				goto out;
-			ret = set_peer(wg, peer);
+			ret = set_peer(wg, peer, batch, &dead_peers);
 			if (ret < 0)
 				goto out;
 		}
@@ -592,6 +1299,9 @@ skip_set_private_key:
 	ret = 0;
 
 out:
+	if (batch)
+		set_peers_batch_free(batch);
+	wg_peer_remove_dead(&dead_peers);
 	mutex_unlock(&wg->device_update_lock);
 	rtnl_unlock();
 	dev_put(wg->dev);
@@ -629,11 +1339,31 @@ struct genl_ops genl_ops[] = {
 	}
 };
 
+#ifndef COMPAT_CANNOT_USE_GENL_MCGRPS
+static const struct genl_multicast_group genl_mcgrps[] = {
+	[WG_MCGRP_PEERS] = { .name = WG_MULTICAST_GROUP_PEERS }
+};
+#endif
+
+#ifndef COMPAT_CANNOT_USE_GENL_MCAST_BIND
+/* Peer events carry the same keys, endpoints and statistics as
+ * WG_CMD_GET_DEVICE, so listening to them needs the same privilege.
+ */
+static int wg_genetlink_mcast_bind(struct net *net, int group)
+{
+	if (!ns_capable(net->user_ns, CAP_NET_ADMIN))
+		return -EPERM;
+	return 0;
+}
+#endif
+
 static struct genl_family genl_family
 #ifndef COMPAT_CANNOT_USE_GENL_NOPS
 __ro_after_init = {
 	.ops = genl_ops,
 	.n_ops = ARRAY_SIZE(genl_ops),
+	.mcgrps = genl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(genl_mcgrps),
 #else
 = {
 #endif
@@ -643,10 +1373,75 @@ __ro_after_init = {
 	.module = THIS_MODULE,
 #ifndef COMPAT_CANNOT_INDIVIDUAL_NETLINK_OPS_POLICY
 	.policy = device_policy,
+#endif
+#ifndef COMPAT_CANNOT_USE_GENL_MCAST_BIND
+	.mcast_bind = wg_genetlink_mcast_bind,
 #endif
 	.netnsok = true
 };
 
+/* Events are made pending on the peer, and then sent from a timer, so that
+ * several that happen in quick succession are coalesced into one message, and
+ * so that they are rate limited per peer.
+ */
+void wg_genetlink_notify_peer(struct wg_peer *peer, enum wgpeer_event event)
+{
+#ifndef COMPAT_CANNOT_USE_GENL_MCGRPS
+	if (!genl_has_listeners(&genl_family, dev_net(peer->device->dev),
+				WG_MCGRP_PEERS))
+		return;
+	set_bit(ilog2(event), &peer->pending_events);
+	wg_timers_events_pending(peer);
+#endif
+}
+
+void wg_genetlink_send_peer_events(struct wg_peer *peer)
+{
+#ifndef COMPAT_CANNOT_USE_GENL_MCGRPS
+	unsigned long events = xchg(&peer->pending_events, 0);
+	struct nlattr *peers_nest, *peer_nest;
+	struct wg_device *wg = peer->device;
+	struct sk_buff *skb;
+	void *hdr;
+
+	if (!events)
+		return;
+	skb = genlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
+	if (!skb)
+		return;
+	hdr = genlmsg_put(skb, 0, 0, &genl_family, 0, WG_CMD_PEER_EVENT);
+	if (!hdr)
+		goto err;
+	if (nla_put_u32(skb, WGDEVICE_A_IFINDEX, wg->dev->ifindex) ||
+	    nla_put_string(skb, WGDEVICE_A_IFNAME, wg->dev->name))
+		goto err;
+	peers_nest = nla_nest_start(skb, WGDEVICE_A_PEERS);
+	if (!peers_nest)
+		goto err;
+	peer_nest = nla_nest_start(skb, 0);
+	if (!peer_nest || nla_put_u32(skb, WGPEER_A_EVENTS, events))
+		goto err;
+#ifndef COMPAT_CANNOT_USE_GENL_MCAST_BIND
+	/* The details are only sent along where listening can be restricted,
+	 * and otherwise need to be fetched with WG_CMD_GET_DEVICE.
+	 */
+	if (nla_put(skb, WGPEER_A_PUBLIC_KEY, NOISE_PUBLIC_KEY_LEN,
+		    peer->handshake.remote_static) ||
+	    get_peer_stats(peer, skb))
+		goto err;
+#endif
+	nla_nest_end(skb, peer_nest);
+	nla_nest_end(skb, peers_nest);
+	genlmsg_end(skb, hdr);
+	genlmsg_multicast_netns(&genl_family, dev_net(wg->dev), skb, 0,
+				WG_MCGRP_PEERS, GFP_ATOMIC);
+	return;
+
+err:
+	nlmsg_free(skb);
+#endif
+}
+
 int __init wg_genetlink_init(void)
 {
 	return genl_register_family(&genl_family);
@@ -6,7 +6,14 @@
 #ifndef _WG_NETLINK_H
 #define _WG_NETLINK_H
 
+#include "uapi/wireguard.h"
+
+struct wg_peer;
+
 int wg_genetlink_init(void);
 void wg_genetlink_uninit(void);
 
+void wg_genetlink_notify_peer(struct wg_peer *peer, enum wgpeer_event event);
+void wg_genetlink_send_peer_events(struct wg_peer *peer);
+
 #endif /* _WG_NETLINK_H */
@@ -9,6 +9,7 @@
 #include "messages.h"
 #include "queueing.h"
 #include "peerlookup.h"
+#include "trace.h"
 
 #include <linux/rcupdate.h>
 #include <linux/slab.h>
@@ -72,7 +73,6 @@ void wg_noise_handshake_init(struct noise_handshake *handshake,
 		       NOISE_SYMMETRIC_KEY_LEN);
 	handshake->static_identity = static_identity;
 	handshake->state = HANDSHAKE_ZEROED;
-	wg_noise_precompute_static_static(peer);
 }
 
 static void handshake_zero(struct noise_handshake *handshake)
@@ -236,6 +236,7 @@ static void add_new_keypair(struct noise_keypairs *keypairs,
 		 */
 		wg_noise_keypair_put(previous_keypair, true);
 		rcu_assign_pointer(keypairs->current_keypair, new_keypair);
+		trace_wg_keypair_rotate(new_keypair);
 	} else {
 		/* If we're the responder, it means we can't use the new keypair
 		 * until we receive confirmation via the first data packet, so
@@ -285,6 +286,7 @@ bool wg_noise_received_with_keypair(struct noise_keypairs *keypairs,
 	wg_noise_keypair_put(old_keypair, true);
 	rcu_assign_pointer(keypairs->current_keypair, received_keypair);
 	RCU_INIT_POINTER(keypairs->next_keypair, NULL);
+	trace_wg_keypair_rotate(received_keypair);
 
 	spin_unlock_bh(&keypairs->keypair_update_lock);
 	return true;
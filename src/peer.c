@@ -6,6 +6,7 @@
 #include "peer.h"
 #include "device.h"
 #include "queueing.h"
+#include "socket.h"
 #include "timers.h"
 #include "peerlookup.h"
 #include "noise.h"
@@ -18,23 +19,21 @@
 static struct kmem_cache *peer_cache;
 static atomic64_t peer_counter = ATOMIC64_INIT(0);
 
-struct wg_peer *wg_peer_create(struct wg_device *wg,
-			       const u8 public_key[NOISE_PUBLIC_KEY_LEN],
-			       const u8 preshared_key[NOISE_SYMMETRIC_KEY_LEN])
+/* The returned peer is not yet known to the device, and does not yet have its
+ * static-static and cookie keys. Callers creating many peers at once can then
+ * do the expensive wg_peer_precompute_keys() for all of them in parallel,
+ * before making them visible with wg_peer_publish(). An unpublished peer is
+ * freed by putting its reference.
+ */
+struct wg_peer *wg_peer_alloc(struct wg_device *wg,
+			      const u8 public_key[NOISE_PUBLIC_KEY_LEN],
+			      const u8 preshared_key[NOISE_SYMMETRIC_KEY_LEN])
 {
 	struct wg_peer *peer;
-	int ret = -ENOMEM;
-
-	lockdep_assert_held(&wg->device_update_lock);
-
-	if (wg->num_peers >= MAX_PEERS_PER_DEVICE)
-		return ERR_PTR(ret);
 
 	peer = kmem_cache_zalloc(peer_cache, GFP_KERNEL);
 	if (unlikely(!peer))
-		return ERR_PTR(ret);
-	if (unlikely(dst_cache_init(&peer->endpoint_cache, GFP_KERNEL)))
-		goto err;
+		return ERR_PTR(-ENOMEM);
 
 	peer->device = wg;
 	wg_noise_handshake_init(&peer->handshake, &wg->static_identity,
@@ -43,16 +42,32 @@ struct wg_peer *wg_peer_create(struct wg_device *wg,
 	peer->serial_work_cpu = nr_cpumask_bits;
 	wg_cookie_init(&peer->latest_cookie);
 	wg_timers_init(peer);
-	wg_cookie_checker_precompute_peer_keys(peer);
 	spin_lock_init(&peer->keypairs.keypair_update_lock);
 	INIT_WORK(&peer->transmit_handshake_work, wg_packet_handshake_send_worker);
 	INIT_WORK(&peer->transmit_packet_work, wg_packet_tx_worker);
-	wg_prev_queue_init(&peer->tx_queue);
-	wg_prev_queue_init(&peer->rx_queue);
+	INIT_WORK(&peer->route_prewarm_work, wg_socket_route_prewarm_worker);
+	wg_prev_queue_init(&peer->tx_queue, wg->max_queued_packets);
+	wg_prev_queue_init(&peer->rx_queue, wg->max_queued_packets);
 	rwlock_init(&peer->endpoint_lock);
 	kref_init(&peer->refcount);
 	skb_queue_head_init(&peer->staged_packet_queue);
 	wg_noise_reset_last_sent_handshake(&peer->last_sent_handshake);
+	INIT_LIST_HEAD(&peer->allowedips_list);
+	return peer;
+}
+
+/* Makes a peer from wg_peer_alloc(), whose keys have been precomputed, known
+ * to the device, and thus reachable by handshakes and configuration.
+ */
+int wg_peer_publish(struct wg_peer *peer)
+{
+	struct wg_device *wg = peer->device;
+
+	lockdep_assert_held(&wg->device_update_lock);
+
+	if (wg->num_peers >= MAX_PEERS_PER_DEVICE)
+		return -ENOMEM;
+
 	set_bit(NAPI_STATE_NO_BUSY_POLL, &peer->napi.state);
 #if defined(IS_NEWER_RHEL8_477)
        netif_napi_add(wg->dev, &peer->napi, wg_packet_rx_poll);
@@ -61,16 +76,44 @@ struct wg_peer *wg_peer_create(struct wg_device *wg,
                        NAPI_POLL_WEIGHT);
 #endif
 	napi_enable(&peer->napi);
-	list_add_tail(&peer->peer_list, &wg->peer_list);
-	INIT_LIST_HEAD(&peer->allowedips_list);
+	list_add_tail_rcu(&peer->peer_list, &wg->peer_list);
 	wg_pubkey_hashtable_add(wg->peer_hashtable, peer);
 	++wg->num_peers;
 	pr_debug("%s: Peer %llu created\n", wg->dev->name, peer->internal_id);
+	return 0;
+}
+
+struct wg_peer *wg_peer_create(struct wg_device *wg,
+			       const u8 public_key[NOISE_PUBLIC_KEY_LEN],
+			       const u8 preshared_key[NOISE_SYMMETRIC_KEY_LEN])
+{
+	struct wg_peer *peer;
+	int ret;
+
+	lockdep_assert_held(&wg->device_update_lock);
+
+	if (wg->num_peers >= MAX_PEERS_PER_DEVICE)
+		return ERR_PTR(-ENOMEM);
+
+	peer = wg_peer_alloc(wg, public_key, preshared_key);
+	if (IS_ERR(peer))
+		return peer;
+	down_read(&wg->static_identity.lock);
+	wg_peer_precompute_keys(peer);
+	up_read(&wg->static_identity.lock);
+	ret = wg_peer_publish(peer);
+	if (ret) {
+		wg_peer_put(peer);
+		return ERR_PTR(ret);
+	}
 	return peer;
+}
 
-err:
-	kmem_cache_free(peer_cache, peer);
-	return ERR_PTR(ret);
+/* Must hold peer->handshake.static_identity->lock */
+void wg_peer_precompute_keys(struct wg_peer *peer)
+{
+	wg_noise_precompute_static_static(peer);
+	wg_cookie_checker_precompute_peer_keys(peer);
 }
 
 struct wg_peer *wg_peer_get_maybe_zero(struct wg_peer *peer)
@@ -84,8 +127,11 @@ struct wg_peer *wg_peer_get_maybe_zero(struct wg_peer *peer)
 
 static void peer_make_dead(struct wg_peer *peer)
 {
-	/* Remove from configuration-time lookup structures. */
-	list_del_init(&peer->peer_list);
+	/* Remove from configuration-time lookup structures. Stats-only
+	 * dumps walk the peer list under RCU, so the entry has to stay intact
+	 * until the grace period.
+	 */
+	list_del_rcu(&peer->peer_list);
 	wg_allowedips_remove_by_peer(&peer->device->peer_allowedips, peer,
 				     &peer->device->device_update_lock);
 	wg_pubkey_hashtable_remove(peer->device->peer_hashtable, peer);
@@ -93,45 +139,61 @@ static void peer_make_dead(struct wg_peer *peer)
 	/* Mark as dead, so that we don't allow jumping contexts after. */
 	WRITE_ONCE(peer->is_dead, true);
 
+	/* A removed peer will never finish coming up. */
+	wg_timers_bring_up_cancel(peer);
+
+	/* Dumps of changes from before now can't express this removal. */
+	atomic64_set(&peer->device->peer_removal_generation,
+		     atomic64_inc_return(&peer->device->peer_generation));
+
 	/* The caller must now synchronize_net() for this to take effect. */
 }
 
-static void peer_remove_after_dead(struct wg_peer *peer)
+static void peer_remove_after_dead(struct list_head *dead_peers)
 {
-	WARN_ON(!peer->is_dead);
+	struct wg_device *wg = list_first_entry(dead_peers, struct wg_peer,
+						dead_list)->device;
+	struct wg_peer *peer, *temp;
 
-	/* No more keypairs can be created for this peer, since is_dead protects
-	 * add_new_keypair, so we can now destroy existing ones.
-	 */
-	wg_noise_keypairs_clear(&peer->keypairs);
+	list_for_each_entry(peer, dead_peers, dead_list) {
+		WARN_ON(!peer->is_dead);
 
-	/* Destroy all ongoing timers that were in-flight at the beginning of
-	 * this function.
-	 */
-	wg_timers_stop(peer);
+		/* No more keypairs can be created for this peer, since is_dead
+		 * protects add_new_keypair, so we can now destroy existing ones.
+		 */
+		wg_noise_keypairs_clear(&peer->keypairs);
+
+		/* Destroy all ongoing timers that were in-flight at the
+		 * beginning of this function.
+		 */
+		wg_timers_stop(peer);
+	}
 
 	/* The transition between packet encryption/decryption queues isn't
 	 * guarded by is_dead, but each reference's life is strictly bounded by
 	 * two generations: once for parallel crypto and once for serial
 	 * ingestion, so we can simply flush twice, and be sure that we no
-	 * longer have references inside these queues.
+	 * longer have references inside these queues. This holds for all of
+	 * the dead peers at once, so the flushes are shared between them.
 	 */
 
 	/* a) For encrypt/decrypt. */
-	flush_workqueue(peer->device->packet_crypt_wq);
+	flush_workqueue(wg->packet_crypt_wq);
 	/* b.1) For send (but not receive, since that's napi). */
-	flush_workqueue(peer->device->packet_crypt_wq);
-	/* b.2.1) For receive (but not send, since that's wq). */
-	napi_disable(&peer->napi);
-	/* b.2.1) It's now safe to remove the napi struct, which must be done
-	 * here from process context.
-	 */
-	netif_napi_del(&peer->napi);
+	flush_workqueue(wg->packet_crypt_wq);
+	list_for_each_entry(peer, dead_peers, dead_list) {
+		/* b.2.1) For receive (but not send, since that's wq). */
+		napi_disable(&peer->napi);
+		/* b.2.1) It's now safe to remove the napi struct, which must be
+		 * done here from process context.
+		 */
+		netif_napi_del(&peer->napi);
+	}
 
 	/* Ensure any workstructs we own (like transmit_handshake_work or
 	 * clear_peer_work) no longer are in use.
 	 */
-	flush_workqueue(peer->device->handshake_send_wq);
+	flush_workqueue(wg->handshake_send_wq);
 
 	/* After the above flushes, a peer might still be active in a few
 	 * different contexts: 1) from xmit(), before hitting is_dead and
@@ -150,23 +212,115 @@ static void peer_remove_after_dead(struct wg_peer *peer)
 	 * with a refcount of zero, so no new reference is taken.
 	 */
 
-	--peer->device->num_peers;
-	wg_peer_put(peer);
+	list_for_each_entry_safe(peer, temp, dead_peers, dead_list) {
+		list_del(&peer->dead_list);
+		wg_peer_put(peer);
+	}
 }
 
-/* We have a separate "remove" function make sure that all active places where
- * a peer is currently operating will eventually come to an end and not pass
- * their reference onto another context.
+/* Removing a peer is split in two, so that many peers can be removed at once
+ * while sharing the expensive parts: wg_peer_mark_dead() takes the peer out of
+ * the lookup structures and puts it on a caller-provided list, after which
+ * wg_peer_remove_dead() waits for a single RCU grace period and a single round
+ * of workqueue flushes for the whole list, making sure that all active places
+ * where a peer is currently operating will eventually come to an end and not
+ * pass their reference onto another context.
  */
-void wg_peer_remove(struct wg_peer *peer)
+void wg_peer_mark_dead(struct wg_peer *peer, struct list_head *dead_peers)
 {
-	if (unlikely(!peer))
-		return;
 	lockdep_assert_held(&peer->device->device_update_lock);
 
 	peer_make_dead(peer);
+	list_add_tail(&peer->dead_list, dead_peers);
+	/* The slot is free as soon as the peer is off the peer list, so that
+	 * a single configuration can remove some peers and add others at the
+	 * limit.
+	 */
+	--peer->device->num_peers;
+}
+
+void wg_peer_remove_dead(struct list_head *dead_peers)
+{
+	if (list_empty(dead_peers))
+		return;
 	synchronize_net();
-	peer_remove_after_dead(peer);
+	peer_remove_after_dead(dead_peers);
+}
+
+void wg_peer_remove(struct wg_peer *peer)
+{
+	LIST_HEAD(dead_peers);
+
+	if (unlikely(!peer))
+		return;
+	wg_peer_mark_dead(peer, &dead_peers);
+	wg_peer_remove_dead(&dead_peers);
+}
+
+struct peer_batch {
+	struct wg_peer **peers;
+	void (*fn)(struct wg_peer *peer);
+	unsigned int len;
+	atomic_t next;
+};
+
+static void peer_batch_run(struct peer_batch *batch)
+{
+	unsigned int i;
+
+	while ((i = atomic_inc_return(&batch->next) - 1) < batch->len) {
+		batch->fn(batch->peers[i]);
+		cond_resched();
+	}
+}
+
+static void peer_batch_worker(struct work_struct *work)
+{
+	peer_batch_run(container_of(work, struct multicore_worker, work)->ptr);
+}
+
+/* Calls fn on each of the peers, spreading the work over all online CPUs. This
+ * is meant for expensive per-peer computations done at configuration time,
+ * such as curve25519 precomputations, which otherwise scale linearly with the
+ * number of peers on a single CPU. It does not return until fn has been called
+ * for every peer, so any locks held by the caller cover the calls to fn.
+ */
+void wg_peer_for_each_parallel(struct wg_device *wg, struct wg_peer **peers,
+			       unsigned int len,
+			       void (*fn)(struct wg_peer *peer))
+{
+	enum { MIN_PEERS_FOR_PARALLEL = 16 };
+	struct multicore_worker __percpu *worker;
+	struct peer_batch batch = {
+		.peers = peers,
+		.fn = fn,
+		.len = len,
+		.next = ATOMIC_INIT(0)
+	};
+	int cpu;
+
+	if (len < MIN_PEERS_FOR_PARALLEL || num_online_cpus() == 1)
+		goto serial;
+	worker = wg_packet_percpu_multicore_worker_alloc(peer_batch_worker,
+							 &batch);
+	if (unlikely(!worker))
+		goto serial;
+
+	for_each_online_cpu(cpu)
+		queue_work_on(cpu, wg->packet_crypt_wq,
+			      &per_cpu_ptr(worker, cpu)->work);
+	/* Help out, rather than sleeping idly until the workers are done. */
+	peer_batch_run(&batch);
+	for_each_possible_cpu(cpu)
+		flush_work(&per_cpu_ptr(worker, cpu)->work);
+	free_percpu(worker);
+	return;
+
+serial:
+	while (len--) {
+		fn(*peers++);
+		cond_resched();
+	}
 }
 
 void wg_peer_remove_all(struct wg_device *wg)
@@ -179,20 +333,16 @@ void wg_peer_remove_all(struct wg_device *wg)
 	/* Avoid having to traverse individually for each one. */
 	wg_allowedips_free(&wg->peer_allowedips, &wg->device_update_lock);
 
-	list_for_each_entry_safe(peer, temp, &wg->peer_list, peer_list) {
-		peer_make_dead(peer);
-		list_add_tail(&peer->peer_list, &dead_peers);
-	}
-	synchronize_net();
-	list_for_each_entry_safe(peer, temp, &dead_peers, peer_list)
-		peer_remove_after_dead(peer);
+	list_for_each_entry_safe(peer, temp, &wg->peer_list, peer_list)
+		wg_peer_mark_dead(peer, &dead_peers);
+	wg_peer_remove_dead(&dead_peers);
 }
 
 static void rcu_release(struct rcu_head *rcu)
 {
 	struct wg_peer *peer = container_of(rcu, struct wg_peer, rcu);
 
-	dst_cache_destroy(&peer->endpoint_cache);
+	wg_socket_endpoint_cache_free(peer);
 	WARN_ON(wg_prev_queue_peek(&peer->tx_queue) || wg_prev_queue_peek(&peer->rx_queue));
 
 	/* The final zeroing takes care of clearing any remaining handshake key
@@ -9,6 +9,7 @@
 #include "device.h"
 #include "noise.h"
 #include "cookie.h"
+#include "timers.h"
 
 #include <linux/types.h>
 #include <linux/netfilter.h>
@@ -32,6 +33,44 @@ struct endpoint {
 		};
 		struct in6_addr src6;
 	};
+	/* The peer listens on this many consecutive ports from addr. */
+	u16 port_count;
+};
+
+/* The parts of an endpoint that can be compared directly against the headers
+ * of a received packet, including the whole range of ports the peer may send
+ * from, so that the receive path can tell it hasn't moved without building a
+ * struct endpoint or taking any lock.
+ */
+struct endpoint_fingerprint {
+	union {
+		struct {
+			__be32 addr4, src4;
+		};
+		struct {
+			struct in6_addr addr6, src6;
+		};
+	};
+	int ifindex;
+	__be16 port;
+	u16 port_span;
+	sa_family_t family;
+};
+
+/* Counted per CPU, since the dst_cache they describe is per CPU as well. */
+struct endpoint_cache_stats {
+	u64 hits, misses;
+};
+
+/* The cached route takes memory on every CPU, about 56 bytes each on 64-bit
+ * with the counters, so a peer only gets one once it does a handshake, and
+ * gives it back when its keys are zeroed after a long enough silence. A peer
+ * coming back from that pays for allocating it again on its first handshake.
+ * It is protected by the peer's endpoint_lock.
+ */
+struct endpoint_cache {
+	struct dst_cache dst;
+	struct endpoint_cache_stats __percpu *stats;
 };
 
 struct wg_peer {
@@ -42,7 +81,10 @@ struct wg_peer {
 	bool is_dead;
 	struct noise_keypairs keypairs;
 	struct endpoint endpoint;
-	struct dst_cache endpoint_cache;
+	struct endpoint_fingerprint endpoint_fingerprint;
+	struct endpoint_cache *endpoint_cache;
+	u64 endpoint_cache_hits, endpoint_cache_misses;
+	struct work_struct route_prewarm_work;
 	rwlock_t endpoint_lock;
 	struct noise_handshake handshake;
 	atomic64_t last_sent_handshake;
@@ -50,9 +92,15 @@ struct wg_peer {
 	struct cookie latest_cookie;
 	struct hlist_node pubkey_hash;
 	u64 rx_bytes, tx_bytes;
-	struct timer_list timer_retransmit_handshake, timer_send_keepalive;
-	struct timer_list timer_new_handshake, timer_zero_key_material;
-	struct timer_list timer_persistent_keepalive;
+	u64 endpoint_roams;
+	struct timer_list timer;
+	unsigned long timer_deadlines[__WG_TIMER_COUNT];
+#ifdef COMPAT_CANNOT_USE_TIMER_REDUCE
+	spinlock_t timer_lock;
+#endif
+	unsigned long pending_events, last_events_sent;
+	unsigned long last_data_sent;
+	atomic_t awaiting_bring_up;
 	unsigned int timer_handshake_attempts;
 	u16 persistent_keepalive_interval;
 	bool timer_need_another_keepalive;
@@ -60,12 +108,18 @@ struct wg_peer {
 	struct timespec64 walltime_last_handshake;
 	struct kref refcount;
 	struct rcu_head rcu;
-	struct list_head peer_list;
+	struct list_head peer_list, dead_list;
 	struct list_head allowedips_list;
 	struct napi_struct napi;
 	u64 internal_id;
+	atomic64_t generation;
 };
 
+struct wg_peer *wg_peer_alloc(struct wg_device *wg,
+			      const u8 public_key[NOISE_PUBLIC_KEY_LEN],
+			      const u8 preshared_key[NOISE_SYMMETRIC_KEY_LEN]);
+void wg_peer_precompute_keys(struct wg_peer *peer);
+int wg_peer_publish(struct wg_peer *peer);
 struct wg_peer *wg_peer_create(struct wg_device *wg,
 			       const u8 public_key[NOISE_PUBLIC_KEY_LEN],
 			       const u8 preshared_key[NOISE_SYMMETRIC_KEY_LEN]);
@@ -77,8 +131,31 @@ static inline struct wg_peer *wg_peer_get(struct wg_peer *peer)
 	return peer;
 }
 void wg_peer_put(struct wg_peer *peer);
+
+/* Marks the peer as changed, for userspace asking for only what changed since
+ * a given generation.
+ */
+static inline void wg_peer_bump_generation(struct wg_peer *peer)
+{
+	s64 generation = atomic64_inc_return(&peer->device->peer_generation);
+	s64 old = atomic64_read(&peer->generation), prev;
+
+	/* Concurrent bumps may land out of order, so only ever move forward. */
+	while (old < generation) {
+		prev = atomic64_cmpxchg(&peer->generation, old, generation);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+}
+
 void wg_peer_remove(struct wg_peer *peer);
+void wg_peer_mark_dead(struct wg_peer *peer, struct list_head *dead_peers);
+void wg_peer_remove_dead(struct list_head *dead_peers);
 void wg_peer_remove_all(struct wg_device *wg);
+void wg_peer_for_each_parallel(struct wg_device *wg, struct wg_peer **peers,
+			       unsigned int len,
+			       void (*fn)(struct wg_peer *peer));
 
 int wg_peer_init(void);
 void wg_peer_uninit(void);
@@ -16,18 +16,20 @@ static struct hlist_head *pubkey_bucket(struct pubkey_hashtable *table,
 	 */
 	const u64 hash = siphash(pubkey, NOISE_PUBLIC_KEY_LEN, &table->key);
 
-	return &table->hashtable[hash & (HASH_SIZE(table->hashtable) - 1)];
+	return &table->hashtable[hash & ((1U << table->bits) - 1)];
 }
 
-struct pubkey_hashtable *wg_pubkey_hashtable_alloc(void)
+struct pubkey_hashtable *wg_pubkey_hashtable_alloc(unsigned int bits)
 {
-	struct pubkey_hashtable *table = kvmalloc(sizeof(*table), GFP_KERNEL);
+	struct pubkey_hashtable *table = kvmalloc(sizeof(*table) +
+		sizeof(table->hashtable[0]) * (1U << bits), GFP_KERNEL);
 
 	if (!table)
 		return NULL;
 
 	get_random_bytes(&table->key, sizeof(table->key));
-	hash_init(table->hashtable);
+	table->bits = bits;
+	__hash_init(table->hashtable, 1U << bits);
 	mutex_init(&table->lock);
 	return table;
 }
@@ -76,18 +78,19 @@ static struct hlist_head *index_bucket(struct index_hashtable *table,
 	/* Since the indices are random and thus all bits are uniformly
 	 * distributed, we can find its bucket simply by masking.
 	 */
-	return &table->hashtable[(__force u32)index &
-				 (HASH_SIZE(table->hashtable) - 1)];
+	return &table->hashtable[(__force u32)index & ((1U << table->bits) - 1)];
 }
 
-struct index_hashtable *wg_index_hashtable_alloc(void)
+struct index_hashtable *wg_index_hashtable_alloc(unsigned int bits)
 {
-	struct index_hashtable *table = kvmalloc(sizeof(*table), GFP_KERNEL);
+	struct index_hashtable *table = kvmalloc(sizeof(*table) +
+		sizeof(table->hashtable[0]) * (1U << bits), GFP_KERNEL);
 
 	if (!table)
 		return NULL;
 
-	hash_init(table->hashtable);
+	table->bits = bits;
+	__hash_init(table->hashtable, 1U << bits);
 	spin_lock_init(&table->lock);
 	return table;
 }
@@ -16,12 +16,13 @@ struct wg_peer;
 
 struct pubkey_hashtable {
 	/* TODO: move to rhashtable */
-	DECLARE_HASHTABLE(hashtable, 11);
 	siphash_key_t key;
 	struct mutex lock;
+	unsigned int bits;
+	struct hlist_head hashtable[];
 };
 
-struct pubkey_hashtable *wg_pubkey_hashtable_alloc(void);
+struct pubkey_hashtable *wg_pubkey_hashtable_alloc(unsigned int bits);
 void wg_pubkey_hashtable_add(struct pubkey_hashtable *table,
 			     struct wg_peer *peer);
 void wg_pubkey_hashtable_remove(struct pubkey_hashtable *table,
@@ -32,8 +33,9 @@ wg_pubkey_hashtable_lookup(struct pubkey_hashtable *table,
 
 struct index_hashtable {
 	/* TODO: move to rhashtable */
-	DECLARE_HASHTABLE(hashtable, 13);
 	spinlock_t lock;
+	unsigned int bits;
+	struct hlist_head hashtable[];
 };
 
 enum index_hashtable_type {
@@ -48,7 +50,7 @@ struct index_hashtable_entry {
 	__le32 index;
 };
 
-struct index_hashtable *wg_index_hashtable_alloc(void);
+struct index_hashtable *wg_index_hashtable_alloc(unsigned int bits);
 __le32 wg_index_hashtable_insert(struct index_hashtable *table,
 				 struct index_hashtable_entry *entry);
 bool wg_index_hashtable_replace(struct index_hashtable *table,
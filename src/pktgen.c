@@ -0,0 +1,681 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2015-2019 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+ *
+ * This is a packet generator for measuring the data path on its own, without a
+ * socket or TCP in the way, which is only built in debug builds. Writing
+ *
+ *     tx|rx <ifname> <count> [<len>]
+ *
+ * to /sys/kernel/debug/wireguard/pktgen generates count IPv4 packets of len
+ * bytes, 1420 by default, for the first peer of the interface that has a
+ * session, and blocks until they have all made it through the pipeline.
+ * Reading the file then gives the time that took. The interface is looked up
+ * in the network namespace of the writer.
+ *
+ * With tx, the plaintext packets are added to the peer's staging queue, just
+ * like wg_xmit does, and are then encrypted and sent to the peer's endpoint,
+ * so this is best used with a pair of interfaces talking over loopback. With
+ * rx, ciphertext is crafted with the session's receiving key and handed to
+ * wg_packet_receive as though it arrived from the peer's endpoint. It decrypts
+ * into packets whose source isn't allowed, so that they are dropped just
+ * before reaching the network stack. This pushes the session's receive counter
+ * ahead of the peer, whose packets are then rejected as replays until the next
+ * handshake, which its timers start soon enough.
+ *
+ * Building the packets, and for rx encrypting them, happens before the clock
+ * starts.
+ *
+ * Writing
+ *
+ *     handshake <ifname> <count> [<rate>]
+ *
+ * instead simulates count peers reconnecting at once. It adds count peers with
+ * new keys to the interface, and then hands it an initiation from each of them,
+ * at rate initiations per second, or as fast as possible without a rate. Once
+ * the handshake queue has drained, the result gives how many were accepted and
+ * how fast, how many were answered with a cookie reply because the interface
+ * was under load, the handshake drops by reason, and the time from injecting
+ * an initiation to the session being derived, at the resolution of the coarse
+ * clock. The peers are then removed again. The initiators never answer cookie
+ * replies or confirm their sessions.
+ */
+
+#include "pktgen.h"
+#include "device.h"
+#include "peer.h"
+#include "queueing.h"
+#include "messages.h"
+
+#include <linux/debugfs.h>
+#include <linux/nsproxy.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/uaccess.h>
+
+enum {
+	PKTGEN_MAX_PACKETS = 1 << 17,
+	PKTGEN_MAX_HANDSHAKES = 1 << 17,
+	PKTGEN_BATCH = 64,
+	PKTGEN_DEFAULT_LEN = 1420,
+	PKTGEN_TIMEOUT = 10 * HZ
+};
+
+static DEFINE_MUTEX(pktgen_lock);
+static struct dentry *pktgen_dir;
+static char pktgen_result[384];
+
+static struct sk_buff *pktgen_alloc_ip(unsigned int len, unsigned int headroom,
+				       unsigned int tailroom)
+{
+	struct sk_buff *skb = alloc_skb(headroom + len + tailroom, GFP_KERNEL);
+	struct iphdr *iph;
+
+	if (unlikely(!skb))
+		return NULL;
+	skb_reserve(skb, headroom);
+	skb_reset_network_header(skb);
+	iph = skb_put_zero(skb, len);
+	iph->version = 4;
+	iph->ihl = sizeof(*iph) / 4;
+	iph->tot_len = htons(len);
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->check = ip_fast_csum(iph, iph->ihl);
+	skb->protocol = htons(ETH_P_IP);
+	return skb;
+}
+
+/* This is a datagram as it arrives on the wire, for wg_packet_receive. */
+static struct sk_buff *pktgen_alloc_udp(__be32 saddr, __be16 sport,
+					__be32 daddr, __be16 dport,
+					unsigned int len)
+{
+	struct sk_buff *skb;
+	struct udphdr *udp;
+	struct iphdr *iph;
+
+	skb = pktgen_alloc_ip(sizeof(*iph) + sizeof(*udp) + len, 0, 0);
+	if (unlikely(!skb))
+		return NULL;
+	iph = ip_hdr(skb);
+	iph->saddr = saddr;
+	iph->daddr = daddr;
+	iph->check = 0;
+	iph->check = ip_fast_csum(iph, iph->ihl);
+	skb_set_transport_header(skb, sizeof(*iph));
+	udp = udp_hdr(skb);
+	udp->source = sport;
+	udp->dest = dport;
+	udp->len = htons(sizeof(*udp) + len);
+	return skb;
+}
+
+/* Our own packets are in the pipeline from the staging queue, or from the rx
+ * queue, until they are sent or delivered.
+ */
+static unsigned int pktgen_in_flight(struct wg_peer *peer, bool tx)
+{
+	if (tx)
+		return READ_ONCE(peer->staged_packet_queue.qlen) +
+		       atomic_read(&peer->tx_queue.count);
+	return atomic_read(&peer->rx_queue.count);
+}
+
+static int pktgen_wait(struct wg_peer *peer, bool tx, unsigned int limit,
+		       unsigned long timeout)
+{
+	while (pktgen_in_flight(peer, tx) > limit) {
+		if (time_after(jiffies, timeout))
+			return -ETIMEDOUT;
+		if (signal_pending(current))
+			return -EINTR;
+		cond_resched();
+		cpu_relax();
+	}
+	return 0;
+}
+
+static int pktgen_build_tx(struct wg_peer *peer, struct sk_buff_head *packets,
+			   unsigned int count, unsigned int len)
+{
+	struct wg_device *wg = peer->device;
+	struct sk_buff *skb;
+
+	while (count--) {
+		skb = pktgen_alloc_ip(len, DATA_PACKET_HEAD_ROOM,
+				      MESSAGE_PADDING_MULTIPLE +
+				      noise_encrypted_len(0));
+		if (unlikely(!skb))
+			return -ENOMEM;
+		skb->dev = wg->dev;
+		PACKET_CB(skb)->mtu = wg->dev->mtu;
+		PACKET_CB(skb)->txq = 0;
+		__skb_queue_tail(packets, skb);
+	}
+	return 0;
+}
+
+static int pktgen_build_rx(struct wg_peer *peer, struct noise_keypair *keypair,
+			   struct sk_buff_head *packets, unsigned int count,
+			   unsigned int len)
+{
+	unsigned int padded_len = ALIGN(len, MESSAGE_PADDING_MULTIPLE);
+	unsigned int data_len = message_data_len(padded_len);
+	struct wg_device *wg = peer->device;
+	struct message_data *data;
+	struct endpoint endpoint;
+	struct sk_buff *skb;
+	struct iphdr *iph;
+	u64 nonce;
+
+	read_lock_bh(&peer->endpoint_lock);
+	endpoint = peer->endpoint;
+	read_unlock_bh(&peer->endpoint_lock);
+	if (endpoint.addr.sa_family != AF_INET)
+		return -EAFNOSUPPORT;
+
+	nonce = READ_ONCE(keypair->receiving_counter.counter) + 1;
+	if (nonce + count >= REJECT_AFTER_MESSAGES)
+		return -ERANGE;
+
+	while (count--) {
+		skb = pktgen_alloc_udp(endpoint.addr4.sin_addr.s_addr,
+				       endpoint.addr4.sin_port,
+				       endpoint.src4.s_addr,
+				       htons(wg->incoming_port), data_len);
+		if (unlikely(!skb))
+			return -ENOMEM;
+
+		/* The inner packet has a zero source address, which no peer is
+		 * allowed to use.
+		 */
+		data = (struct message_data *)(udp_hdr(skb) + 1);
+		data->header.type = cpu_to_le32(MESSAGE_DATA);
+		data->key_idx = keypair->entry.index;
+		data->counter = cpu_to_le64(nonce);
+		iph = (struct iphdr *)data->encrypted_data;
+		iph->version = 4;
+		iph->ihl = sizeof(*iph) / 4;
+		iph->tot_len = htons(len);
+		iph->ttl = 64;
+		iph->protocol = IPPROTO_UDP;
+		chacha20poly1305_encrypt(data->encrypted_data,
+					 data->encrypted_data, padded_len,
+					 NULL, 0, nonce++, keypair->receiving.key);
+		skb->dev = wg->dev;
+		__skb_queue_tail(packets, skb);
+	}
+	return 0;
+}
+
+static void pktgen_inject(struct wg_peer *peer, bool tx, struct sk_buff *skb)
+{
+	if (tx) {
+		wg_latency_stamp(peer->device, skb);
+		spin_lock_bh(&peer->staged_packet_queue.lock);
+		__skb_queue_tail(&peer->staged_packet_queue, skb);
+		spin_unlock_bh(&peer->staged_packet_queue.lock);
+	} else {
+		local_bh_disable();
+		wg_packet_receive(peer->device, skb);
+		local_bh_enable();
+	}
+}
+
+static int pktgen_run(struct wg_peer *peer, struct noise_keypair *keypair,
+		      bool tx, unsigned int count, unsigned int len)
+{
+	unsigned long timeout = jiffies + PKTGEN_TIMEOUT;
+	struct sk_buff_head packets;
+	unsigned int limit, batch, i;
+	struct sk_buff *skb;
+	u64 start, elapsed;
+	int ret;
+
+	__skb_queue_head_init(&packets);
+	if (tx)
+		ret = pktgen_build_tx(peer, &packets, count, len);
+	else
+		ret = pktgen_build_rx(peer, keypair, &packets, count, len);
+	if (ret)
+		goto out;
+
+	/* Stay well clear of dropping packets for lack of room. */
+	limit = tx ? min_t(unsigned int, peer->tx_queue.limit,
+			   peer->device->max_staged_packets) :
+		     peer->rx_queue.limit;
+	limit /= 2;
+	batch = clamp_t(unsigned int, limit, 1, PKTGEN_BATCH);
+
+	start = ktime_get_ns();
+	while (!skb_queue_empty(&packets)) {
+		for (i = 0; i < batch &&
+			    (skb = __skb_dequeue(&packets)) != NULL; ++i)
+			pktgen_inject(peer, tx, skb);
+		if (tx)
+			wg_packet_send_staged_packets(peer);
+		ret = pktgen_wait(peer, tx, limit, timeout);
+		if (ret)
+			goto out;
+	}
+	ret = pktgen_wait(peer, tx, 0, timeout);
+	if (ret)
+		goto out;
+	elapsed = max_t(u64, ktime_get_ns() - start, 1);
+
+	snprintf(pktgen_result, sizeof(pktgen_result),
+		 "%s %s peer %llu: %u packets of %u bytes in %llu ns, %llu ns/packet, %llu pps\n",
+		 tx ? "tx" : "rx", peer->device->dev->name, peer->internal_id,
+		 count, len, elapsed, div_u64(elapsed, count),
+		 div64_u64((u64)count * NSEC_PER_SEC, elapsed));
+
+out:
+	__skb_queue_purge(&packets);
+	return ret;
+}
+
+struct pktgen_initiator {
+	struct message_handshake_initiation message;
+	u8 public_key[NOISE_PUBLIC_KEY_LEN];
+	u64 sent;
+};
+
+static const enum wgdrop_reason pktgen_handshake_drops[] = {
+	WGDROP_HANDSHAKE_QUEUE_FULL, WGDROP_HANDSHAKE_UNDER_LOAD,
+	WGDROP_HANDSHAKE_RATELIMITED, WGDROP_HANDSHAKE_INVALID_MAC,
+	WGDROP_HANDSHAKE_INVALID
+};
+
+static void pktgen_read_drops(struct wg_device *wg,
+			      u64 drops[ARRAY_SIZE(pktgen_handshake_drops)])
+{
+	unsigned int i;
+	int cpu;
+
+	for (i = 0; i < ARRAY_SIZE(pktgen_handshake_drops); ++i) {
+		drops[i] = 0;
+		for_each_possible_cpu(cpu)
+			drops[i] += READ_ONCE(per_cpu_ptr(wg->drops, cpu)->count[
+				pktgen_handshake_drops[i]]);
+	}
+}
+
+/* Each initiator gets a fresh static identity, and its initiation is made by
+ * a scratch peer that exists only for this, whose index is taken out of the
+ * device's table again straight away, since no response ever reaches it.
+ */
+static int pktgen_build_handshakes(struct wg_device *wg,
+				   struct pktgen_initiator *initiators,
+				   unsigned int count)
+{
+	u8 responder_public[NOISE_PUBLIC_KEY_LEN];
+	struct noise_static_identity *identity;
+	struct wg_peer *scratch;
+	unsigned int i;
+	int ret = -ENOKEY;
+
+	down_read(&wg->static_identity.lock);
+	if (wg->static_identity.has_identity) {
+		memcpy(responder_public, wg->static_identity.static_public,
+		       NOISE_PUBLIC_KEY_LEN);
+		ret = 0;
+	}
+	up_read(&wg->static_identity.lock);
+	if (ret)
+		return ret;
+
+	identity = kzalloc(sizeof(*identity), GFP_KERNEL);
+	scratch = kzalloc(sizeof(*scratch), GFP_KERNEL);
+	ret = -ENOMEM;
+	if (unlikely(!identity || !scratch))
+		goto out;
+	init_rwsem(&identity->lock);
+	identity->has_identity = true;
+	scratch->device = wg;
+
+	for (i = 0; i < count; ++i) {
+		struct pktgen_initiator *initiator = &initiators[i];
+
+		ret = -EIO;
+		curve25519_generate_secret(identity->static_private);
+		if (!curve25519_generate_public(identity->static_public,
+						identity->static_private))
+			goto out;
+		wg_noise_handshake_init(&scratch->handshake, identity,
+					responder_public, NULL, scratch);
+		wg_cookie_init(&scratch->latest_cookie);
+		down_read(&identity->lock);
+		wg_peer_precompute_keys(scratch);
+		up_read(&identity->lock);
+		if (!wg_noise_handshake_create_initiation(&initiator->message,
+							  &scratch->handshake))
+			goto out;
+		wg_index_hashtable_remove(wg->index_hashtable,
+					  &scratch->handshake.entry);
+		wg_cookie_add_mac_to_packet(&initiator->message,
+					    sizeof(initiator->message), scratch);
+		memcpy(initiator->public_key, identity->static_public,
+		       NOISE_PUBLIC_KEY_LEN);
+
+		ret = -EINTR;
+		if (signal_pending(current))
+			goto out;
+		cond_resched();
+	}
+	ret = 0;
+
+out:
+	/* A lookup might still be looking at the scratch peer's old index. */
+	synchronize_net();
+	kfree(scratch);
+	kfree_sensitive(identity);
+	return ret;
+}
+
+/* The responder gets a peer for each initiator, without allowed IPs or an
+ * endpoint, just as when a large configuration has been loaded while all of
+ * its peers were away. The references taken here are given back by
+ * pktgen_remove_peers.
+ */
+static int pktgen_add_peers(struct wg_device *wg,
+			    struct pktgen_initiator *initiators,
+			    struct wg_peer **peers, unsigned int count)
+{
+	unsigned int i, num_alloced;
+	int ret = 0;
+
+	for (i = 0; i < count; ++i) {
+		peers[i] = wg_peer_alloc(wg, initiators[i].public_key, NULL);
+		if (IS_ERR(peers[i])) {
+			ret = PTR_ERR(peers[i]);
+			peers[i] = NULL;
+			break;
+		}
+	}
+	num_alloced = i;
+
+	mutex_lock(&wg->device_update_lock);
+	down_read(&wg->static_identity.lock);
+	wg_peer_for_each_parallel(wg, peers, num_alloced,
+				  wg_peer_precompute_keys);
+	up_read(&wg->static_identity.lock);
+	for (i = 0; i < num_alloced; ++i) {
+		if (!ret)
+			ret = wg_peer_publish(peers[i]);
+		if (ret) {
+			wg_peer_put(peers[i]);
+			peers[i] = NULL;
+			continue;
+		}
+		/* pktgen_remove_peers() puts this one. */
+		wg_peer_get(peers[i]);
+	}
+	mutex_unlock(&wg->device_update_lock);
+	return ret;
+}
+
+static void pktgen_remove_peers(struct wg_device *wg, struct wg_peer **peers,
+				unsigned int count)
+{
+	LIST_HEAD(dead_peers);
+	unsigned int i;
+
+	mutex_lock(&wg->device_update_lock);
+	for (i = 0; i < count && peers[i]; ++i) {
+		if (!READ_ONCE(peers[i]->is_dead))
+			wg_peer_mark_dead(peers[i], &dead_peers);
+	}
+	wg_peer_remove_dead(&dead_peers);
+	mutex_unlock(&wg->device_update_lock);
+	for (i = 0; i < count && peers[i]; ++i)
+		wg_peer_put(peers[i]);
+}
+
+/* Each initiation comes from its own address in 127.0.0.0/8, so that the
+ * responder's per-source limits treat the initiators as separate hosts. With
+ * a rate, they are spread out evenly over time, and otherwise they are all
+ * fired at once, leaving it to the handshake queue to keep up or drop them.
+ */
+static int pktgen_storm(struct wg_device *wg,
+			struct pktgen_initiator *initiators, unsigned int count,
+			unsigned int rate)
+{
+	__be32 daddr = htonl(INADDR_LOOPBACK);
+	struct sk_buff *skb;
+	unsigned int i;
+	u64 start, next;
+
+	start = ktime_get_ns();
+	for (i = 0; i < count; ++i) {
+		if (rate) {
+			next = start + div_u64((u64)i * NSEC_PER_SEC, rate);
+			while (ktime_get_ns() < next) {
+				if (signal_pending(current))
+					return -EINTR;
+				cond_resched();
+				cpu_relax();
+			}
+		}
+		skb = pktgen_alloc_udp(htonl((IN_LOOPBACKNET << 24) | (i + 2)),
+				       htons(1024 + i % 64512), daddr,
+				       htons(wg->incoming_port),
+				       sizeof(initiators[i].message));
+		if (unlikely(!skb))
+			return -ENOMEM;
+		memcpy(udp_hdr(skb) + 1, &initiators[i].message,
+		       sizeof(initiators[i].message));
+		skb->dev = wg->dev;
+		initiators[i].sent = ktime_get_coarse_boottime_ns();
+		local_bh_disable();
+		wg_packet_receive(wg, skb);
+		local_bh_enable();
+		if (!rate && !(i % PKTGEN_BATCH))
+			cond_resched();
+	}
+	return 0;
+}
+
+static int pktgen_wait_handshakes(struct wg_device *wg, unsigned long timeout)
+{
+	while (atomic_read(&wg->handshake_queue_len)) {
+		if (time_after(jiffies, timeout))
+			return -ETIMEDOUT;
+		if (signal_pending(current))
+			return -EINTR;
+		schedule_timeout_interruptible(1);
+	}
+	return 0;
+}
+
+static int pktgen_run_handshakes(struct wg_device *wg, unsigned int count,
+				 unsigned int rate)
+{
+	u64 drops[ARRAY_SIZE(pktgen_handshake_drops)];
+	u64 before[ARRAY_SIZE(pktgen_handshake_drops)];
+	u64 start, elapsed, latency, latency_sum = 0, latency_max = 0;
+	struct pktgen_initiator *initiators;
+	struct noise_keypair *keypair;
+	unsigned int i, accepted = 0;
+	struct wg_peer **peers;
+	int ret = -ENOMEM;
+
+	initiators = kvcalloc(count, sizeof(*initiators), GFP_KERNEL);
+	peers = kvcalloc(count, sizeof(*peers), GFP_KERNEL);
+	if (unlikely(!initiators || !peers))
+		goto out;
+	ret = pktgen_build_handshakes(wg, initiators, count);
+	if (ret)
+		goto out;
+	ret = pktgen_add_peers(wg, initiators, peers, count);
+	if (ret)
+		goto out_peers;
+
+	pktgen_read_drops(wg, before);
+	start = ktime_get_ns();
+	ret = pktgen_storm(wg, initiators, count, rate);
+	if (ret)
+		goto out_peers;
+	ret = pktgen_wait_handshakes(wg, jiffies + PKTGEN_TIMEOUT);
+	if (ret)
+		goto out_peers;
+	elapsed = max_t(u64, ktime_get_ns() - start, 1);
+	pktgen_read_drops(wg, drops);
+	for (i = 0; i < ARRAY_SIZE(drops); ++i)
+		drops[i] -= before[i];
+
+	/* The responder holds the new session as its next keypair until the
+	 * initiator confirms it, which these initiators never do.
+	 */
+	rcu_read_lock_bh();
+	for (i = 0; i < count; ++i) {
+		keypair = rcu_dereference_bh(peers[i]->keypairs.next_keypair);
+		if (!keypair || keypair->sending.birthdate < initiators[i].sent)
+			continue;
+		latency = keypair->sending.birthdate - initiators[i].sent;
+		latency_sum += latency;
+		latency_max = max(latency_max, latency);
+		++accepted;
+	}
+	rcu_read_unlock_bh();
+
+	snprintf(pktgen_result, sizeof(pktgen_result),
+		 "handshake %s: %u initiations at %u/s in %llu ns, %u accepted, %llu accepted/s, %llu cookie replies, drops: %llu queue full, %llu ratelimited, %llu invalid mac, %llu invalid, latency to session: %llu us average, %llu us max\n",
+		 wg->dev->name, count, rate, elapsed, accepted,
+		 div64_u64((u64)accepted * NSEC_PER_SEC, elapsed), drops[1],
+		 drops[0], drops[2], drops[3], drops[4],
+		 accepted ? div_u64(latency_sum, accepted * NSEC_PER_USEC) : 0,
+		 div_u64(latency_max, NSEC_PER_USEC));
+
+out_peers:
+	pktgen_remove_peers(wg, peers, count);
+out:
+	kvfree(peers);
+	kvfree(initiators);
+	return ret;
+}
+
+static int pktgen_packets(struct wg_device *wg, bool tx, unsigned int count,
+			  unsigned int len)
+{
+	struct noise_keypair *keypair = NULL;
+	struct wg_peer *peer, *found = NULL;
+	int ret;
+
+	if (!count || count > PKTGEN_MAX_PACKETS || len < sizeof(struct iphdr) ||
+	    len > U16_MAX - DATA_PACKET_HEAD_ROOM - MESSAGE_PADDING_MULTIPLE -
+		  noise_encrypted_len(0))
+		return -EINVAL;
+
+	mutex_lock(&wg->device_update_lock);
+	list_for_each_entry(peer, &wg->peer_list, peer_list) {
+		rcu_read_lock_bh();
+		keypair = wg_noise_keypair_get(
+			rcu_dereference_bh(peer->keypairs.current_keypair));
+		rcu_read_unlock_bh();
+		if (keypair && READ_ONCE(keypair->sending.is_valid) &&
+		    READ_ONCE(keypair->receiving.is_valid)) {
+			found = wg_peer_get(peer);
+			break;
+		}
+		wg_noise_keypair_put(keypair, false);
+		keypair = NULL;
+	}
+	mutex_unlock(&wg->device_update_lock);
+	if (!found)
+		return -ENOKEY;
+
+	mutex_lock(&pktgen_lock);
+	ret = pktgen_run(found, keypair, tx, count, len);
+	mutex_unlock(&pktgen_lock);
+
+	wg_noise_keypair_put(keypair, false);
+	wg_peer_put(found);
+	return ret;
+}
+
+static int pktgen_handshakes(struct wg_device *wg, unsigned int count,
+			     unsigned int rate)
+{
+	int ret;
+
+	if (!count || count > PKTGEN_MAX_HANDSHAKES)
+		return -EINVAL;
+	if (!netif_running(wg->dev))
+		return -ENETDOWN;
+
+	mutex_lock(&pktgen_lock);
+	ret = pktgen_run_handshakes(wg, count, rate);
+	mutex_unlock(&pktgen_lock);
+	return ret;
+}
+
+static ssize_t pktgen_write(struct file *file, const char __user *ubuf,
+			    size_t size, loff_t *off)
+{
+	char buf[64], mode[10], ifname[IFNAMSIZ];
+	unsigned int count, arg;
+	struct net_device *dev;
+	struct wg_device *wg;
+	int ret, args;
+
+	if (size >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, size))
+		return -EFAULT;
+	buf[size] = '\0';
+	args = sscanf(buf, "%9s %15s %u %u", mode, ifname, &count, &arg);
+	if (args < 3)
+		return -EINVAL;
+
+	dev = dev_get_by_name(current->nsproxy->net_ns, ifname);
+	if (!dev)
+		return -ENODEV;
+	ret = -EOPNOTSUPP;
+	if (!dev->rtnl_link_ops || !dev->rtnl_link_ops->kind ||
+	    strcmp(dev->rtnl_link_ops->kind, KBUILD_MODNAME))
+		goto out;
+	wg = netdev_priv(dev);
+
+	ret = -EINVAL;
+	if (!strcmp(mode, "tx") || !strcmp(mode, "rx"))
+		ret = pktgen_packets(wg, mode[0] == 't', count,
+				     args == 4 ? arg : PKTGEN_DEFAULT_LEN);
+	else if (!strcmp(mode, "handshake"))
+		ret = pktgen_handshakes(wg, count, args == 4 ? arg : 0);
+
+out:
+	dev_put(dev);
+	return ret ? ret : size;
+}
+
+static ssize_t pktgen_read(struct file *file, char __user *ubuf, size_t size,
+			   loff_t *off)
+{
+	ssize_t ret;
+
+	mutex_lock(&pktgen_lock);
+	ret = simple_read_from_buffer(ubuf, size, off, pktgen_result,
+				      strlen(pktgen_result));
+	mutex_unlock(&pktgen_lock);
+	return ret;
+}
+
+static const struct file_operations pktgen_fops = {
+	.owner = THIS_MODULE,
+	.read = pktgen_read,
+	.write = pktgen_write,
+	.llseek = default_llseek
+};
+
+void wg_pktgen_init(void)
+{
+	pktgen_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	debugfs_create_file("pktgen", 0600, pktgen_dir, NULL, &pktgen_fops);
+}
+
+void wg_pktgen_uninit(void)
+{
+	debugfs_remove_recursive(pktgen_dir);
+}
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (C) 2015-2019 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+ */
+
+#ifndef _WG_PKTGEN_H
+#define _WG_PKTGEN_H
+
+#ifdef DEBUG
+void wg_pktgen_init(void);
+void wg_pktgen_uninit(void);
+#else
+static inline void wg_pktgen_init(void) { }
+static inline void wg_pktgen_uninit(void) { }
+#endif
+
+#endif /* _WG_PKTGEN_H */
@@ -46,15 +46,40 @@ void wg_packet_queue_free(struct crypt_queue *queue, bool purge)
 	ptr_ring_cleanup(&queue->ring, purge ? __skb_array_destroy_skb : NULL);
 }
 
+/* This is read without the ring's locks, so it is only good for statistics.
+ * Consumed entries are zeroed in batches, and until then producers see them as
+ * still occupied, which is what is counted here too.
+ */
+unsigned int wg_packet_queue_len(struct crypt_queue *queue)
+{
+	struct ptr_ring *ring = &queue->ring;
+	int producer = READ_ONCE(ring->producer);
+	int consumer = READ_ONCE(ring->consumer_head);
+
+	if (producer == consumer)
+		return READ_ONCE(ring->queue[producer]) ? ring->size : 0;
+	return (producer - consumer + ring->size) % ring->size;
+}
+
+void wg_packet_queue_sample(struct crypt_queue *queue)
+{
+	unsigned int len = wg_packet_queue_len(queue);
+
+	if (unlikely(len > READ_ONCE(queue->peak)))
+		WRITE_ONCE(queue->peak, len);
+}
+
 #define NEXT(skb) ((skb)->prev)
 #define STUB(queue) ((struct sk_buff *)&queue->empty)
 
-void wg_prev_queue_init(struct prev_queue *queue)
+void wg_prev_queue_init(struct prev_queue *queue, int limit)
 {
 	NEXT(STUB(queue)) = NULL;
 	queue->head = queue->tail = STUB(queue);
 	queue->peeked = NULL;
 	atomic_set(&queue->count, 0);
+	queue->limit = limit;
+	queue->peak = 0;
 	BUILD_BUG_ON(
 		offsetof(struct sk_buff, next) != offsetof(struct prev_queue, empty.next) -
 							offsetof(struct prev_queue, empty) ||
@@ -70,8 +95,13 @@ static void __wg_prev_queue_enqueue(struct prev_queue *queue, struct sk_buff *sk
 
 bool wg_prev_queue_enqueue(struct prev_queue *queue, struct sk_buff *skb)
 {
-	if (!atomic_add_unless(&queue->count, 1, MAX_QUEUED_PACKETS))
+	int count;
+
+	if (!atomic_add_unless(&queue->count, 1, queue->limit))
 		return false;
+	count = atomic_read(&queue->count);
+	if (unlikely(count > READ_ONCE(queue->peak)))
+		WRITE_ONCE(queue->peak, count);
 	__wg_prev_queue_enqueue(queue, skb);
 	return true;
 }
@@ -106,3 +136,60 @@ struct sk_buff *wg_prev_queue_dequeue(struct prev_queue *queue)
 
 #undef NEXT
 #undef STUB
+
+void wg_packet_drop(struct wg_device *wg, struct sk_buff *skb,
+		    enum wgdrop_reason reason)
+{
+	wg_count_drop(wg, reason);
+	kfree_skb(skb);
+}
+
+void wg_packet_drop_list(struct wg_device *wg, struct sk_buff *first,
+			 enum wgdrop_reason reason)
+{
+	struct sk_buff *skb, *next;
+
+	skb_list_walk_safe(first, skb, next)
+		wg_packet_drop(wg, skb, reason);
+}
+
+DEFINE_STATIC_KEY_FALSE(wg_latency_stats_key);
+
+/* Must hold wg->device_update_lock. Enabling starts the histograms afresh. */
+int wg_latency_stats_set(struct wg_device *wg, bool enable)
+{
+	int cpu;
+
+	lockdep_assert_held(&wg->device_update_lock);
+
+	if (enable == wg->latency_stats)
+		return 0;
+	if (!enable) {
+		WRITE_ONCE(wg->latency_stats, false);
+		static_branch_dec(&wg_latency_stats_key);
+		return 0;
+	}
+	if (!wg->latency_hist) {
+		struct wg_latency_hist __percpu *hist =
+			alloc_percpu(struct wg_latency_hist);
+
+		if (!hist)
+			return -ENOMEM;
+		WRITE_ONCE(wg->latency_hist, hist);
+	} else {
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(wg->latency_hist, cpu), 0,
+			       sizeof(struct wg_latency_hist));
+	}
+	static_branch_inc(&wg_latency_stats_key);
+	WRITE_ONCE(wg->latency_stats, true);
+	return 0;
+}
+
+/* Only once no more packets can be in flight. */
+void wg_latency_stats_free(struct wg_device *wg)
+{
+	if (wg->latency_stats)
+		static_branch_dec(&wg_latency_stats_key);
+	free_percpu(wg->latency_hist);
+}
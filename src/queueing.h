@@ -11,6 +11,7 @@
 #include <linux/skbuff.h>
 #include <linux/ip.h>
 #include <linux/ipv6.h>
+#include <linux/jump_label.h>
 #include <net/ip_tunnels.h>
 
 struct wg_device;
@@ -24,6 +25,12 @@ struct sk_buff;
 int wg_packet_queue_init(struct crypt_queue *queue, work_func_t function,
 			 unsigned int len);
 void wg_packet_queue_free(struct crypt_queue *queue, bool purge);
+unsigned int wg_packet_queue_len(struct crypt_queue *queue);
+void wg_packet_queue_sample(struct crypt_queue *queue);
+void wg_packet_drop(struct wg_device *wg, struct sk_buff *skb,
+		    enum wgdrop_reason reason);
+void wg_packet_drop_list(struct wg_device *wg, struct sk_buff *first,
+			 enum wgdrop_reason reason);
 struct multicore_worker __percpu *
 wg_packet_percpu_multicore_worker_alloc(work_func_t function, void *ptr);
 
@@ -60,13 +67,64 @@ struct packet_cb {
 	u64 nonce;
 	struct noise_keypair *keypair;
 	atomic_t state;
+	u64 stamp;
 	u32 mtu;
+	u16 txq;
 	u8 ds;
+	u8 drop_reason; /* Set along with PACKET_STATE_DEAD. */
 };
 
 #define PACKET_CB(skb) ((struct packet_cb *)((skb)->cb))
 #define PACKET_PEER(skb) (PACKET_CB(skb)->keypair->entry.peer)
 
+/* Enabled while any device collects latency statistics, so that otherwise the
+ * timestamping below costs no more than a store.
+ */
+DECLARE_STATIC_KEY_FALSE(wg_latency_stats_key);
+
+int wg_latency_stats_set(struct wg_device *wg, bool enable);
+void wg_latency_stats_free(struct wg_device *wg);
+
+static inline void wg_latency_stamp(struct wg_device *wg, struct sk_buff *skb)
+{
+	PACKET_CB(skb)->stamp = 0;
+	if (static_branch_unlikely(&wg_latency_stats_key) &&
+	    READ_ONCE(wg->latency_stats))
+		PACKET_CB(skb)->stamp = ktime_get_ns();
+}
+
+/* Counts the time since the last stamp towards a stage, and restamps. Packets
+ * stamped at all imply that the device's histograms are allocated.
+ */
+static inline void wg_latency_record(struct wg_device *wg, struct sk_buff *skb,
+				     enum wglatency_stage stage)
+{
+	u64 now;
+
+	if (!static_branch_unlikely(&wg_latency_stats_key) ||
+	    !PACKET_CB(skb)->stamp)
+		return;
+	now = ktime_get_ns();
+	this_cpu_inc(wg->latency_hist->buckets[stage][
+		min_t(unsigned int, fls64(now - PACKET_CB(skb)->stamp),
+		      WGLATENCY_BUCKETS - 1)]);
+	PACKET_CB(skb)->stamp = now;
+}
+
+static inline void wg_worker_account_busy(struct multicore_worker *worker,
+					  u64 start)
+{
+	WRITE_ONCE(worker->busy_time,
+		   worker->busy_time + ktime_get_ns() - start);
+}
+
+/* For packets that were already freed elsewhere. */
+static inline void wg_count_drop(struct wg_device *wg,
+				 enum wgdrop_reason reason)
+{
+	this_cpu_inc(wg->drops->count[reason]);
+}
+
 static inline bool wg_check_packet_protocol(struct sk_buff *skb)
 {
 	__be16 real_protocol = ip_tunnel_parse_protocol(skb);
@@ -145,7 +203,7 @@ static inline int wg_cpumask_next_online(int *next)
 	return cpu;
 }
 
-void wg_prev_queue_init(struct prev_queue *queue);
+void wg_prev_queue_init(struct prev_queue *queue, int limit);
 
 /* Multi producer */
 bool wg_prev_queue_enqueue(struct prev_queue *queue, struct sk_buff *skb);
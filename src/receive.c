@@ -9,6 +9,7 @@
 #include "timers.h"
 #include "messages.h"
 #include "cookie.h"
+#include "trace.h"
 #include "socket.h"
 
 #include <linux/simd.h>
@@ -97,8 +98,9 @@ static int prepare_skb_header(struct sk_buff *skb, struct wg_device *wg)
 	return 0;
 }
 
-static void wg_receive_handshake_packet(struct wg_device *wg,
-					struct sk_buff *skb)
+/* Returns the reason for dropping the packet, or 0 if it was consumed. */
+static enum wgdrop_reason wg_receive_handshake_packet(struct wg_device *wg,
+						      struct sk_buff *skb)
 {
 	enum cookie_mac_state mac_state;
 	struct wg_peer *peer = NULL;
@@ -114,11 +116,12 @@ static void wg_receive_handshake_packet(struct wg_device *wg,
 					wg->dev->name, skb);
 		wg_cookie_message_consume(
 			(struct message_handshake_cookie *)skb->data, wg);
-		return;
+		trace_wg_handshake(NULL, MESSAGE_HANDSHAKE_COOKIE, false);
+		return 0;
 	}
 
 	under_load = atomic_read(&wg->handshake_queue_len) >=
-			MAX_QUEUED_INCOMING_HANDSHAKES / 8;
+			wg->max_queued_handshakes / 8;
 	if (under_load) {
 		last_under_load = ktime_get_coarse_boottime_ns();
 	} else if (last_under_load) {
@@ -133,10 +136,12 @@ static void wg_receive_handshake_packet(struct wg_device *wg,
 		packet_needs_cookie = false;
 	} else if (under_load && mac_state == VALID_MAC_BUT_NO_COOKIE) {
 		packet_needs_cookie = true;
+	} else if (mac_state == VALID_MAC_WITH_COOKIE_BUT_RATELIMITED) {
+		return WGDROP_HANDSHAKE_RATELIMITED;
 	} else {
 		net_dbg_skb_ratelimited("%s: Invalid MAC of handshake, dropping packet from %pISpfsc\n",
 					wg->dev->name, skb);
-		return;
+		return WGDROP_HANDSHAKE_INVALID_MAC;
 	}
 
 	switch (SKB_TYPE_LE32(skb)) {
@@ -147,15 +152,16 @@ static void wg_receive_handshake_packet(struct wg_device *wg,
 		if (packet_needs_cookie) {
 			wg_packet_send_handshake_cookie(wg, skb,
 							message->sender_index);
-			return;
+			return WGDROP_HANDSHAKE_UNDER_LOAD;
 		}
 		peer = wg_noise_handshake_consume_initiation(message, wg);
 		if (unlikely(!peer)) {
 			net_dbg_skb_ratelimited("%s: Invalid handshake initiation from %pISpfsc\n",
 						wg->dev->name, skb);
-			return;
+			return WGDROP_HANDSHAKE_INVALID;
 		}
 		wg_socket_set_peer_endpoint_from_skb(peer, skb);
+		trace_wg_handshake(peer, MESSAGE_HANDSHAKE_INITIATION, false);
 		net_dbg_ratelimited("%s: Receiving handshake initiation from peer %llu (%pISpfsc)\n",
 				    wg->dev->name, peer->internal_id,
 				    &peer->endpoint.addr);
@@ -169,15 +175,16 @@ static void wg_receive_handshake_packet(struct wg_device *wg,
 		if (packet_needs_cookie) {
 			wg_packet_send_handshake_cookie(wg, skb,
 							message->sender_index);
-			return;
+			return WGDROP_HANDSHAKE_UNDER_LOAD;
 		}
 		peer = wg_noise_handshake_consume_response(message, wg);
 		if (unlikely(!peer)) {
 			net_dbg_skb_ratelimited("%s: Invalid handshake response from %pISpfsc\n",
 						wg->dev->name, skb);
-			return;
+			return WGDROP_HANDSHAKE_INVALID;
 		}
 		wg_socket_set_peer_endpoint_from_skb(peer, skb);
+		trace_wg_handshake(peer, MESSAGE_HANDSHAKE_RESPONSE, false);
 		net_dbg_ratelimited("%s: Receiving handshake response from peer %llu (%pISpfsc)\n",
 				    wg->dev->name, peer->internal_id,
 				    &peer->endpoint.addr);
@@ -199,7 +206,7 @@ static void wg_receive_handshake_packet(struct wg_device *wg,
 
 	if (unlikely(!peer)) {
 		WARN(1, "Somehow a wrong type of packet wound up in the handshake queue!\n");
-		return;
+		return WGDROP_INVALID_HEADER;
 	}
 
 	local_bh_disable();
@@ -209,20 +216,28 @@ static void wg_receive_handshake_packet(struct wg_device *wg,
 	wg_timers_any_authenticated_packet_received(peer);
 	wg_timers_any_authenticated_packet_traversal(peer);
 	wg_peer_put(peer);
+	return 0;
 }
 
 void wg_packet_handshake_receive_worker(struct work_struct *work)
 {
-	struct crypt_queue *queue = container_of(work, struct multicore_worker, work)->ptr;
+	struct multicore_worker *worker = container_of(work, struct multicore_worker, work);
+	struct crypt_queue *queue = worker->ptr;
 	struct wg_device *wg = container_of(queue, struct wg_device, handshake_queue);
+	enum wgdrop_reason reason;
 	struct sk_buff *skb;
+	u64 start = ktime_get_ns();
 
 	while ((skb = ptr_ring_consume_bh(&queue->ring)) != NULL) {
-		wg_receive_handshake_packet(wg, skb);
-		dev_kfree_skb(skb);
+		reason = wg_receive_handshake_packet(wg, skb);
+		if (reason)
+			wg_packet_drop(wg, skb, reason);
+		else
+			dev_kfree_skb(skb);
 		atomic_dec(&wg->handshake_queue_len);
 		cond_resched();
 	}
+	wg_worker_account_busy(worker, start);
 }
 
 static void keep_key_fresh(struct wg_peer *peer)
@@ -238,7 +253,8 @@ static void keep_key_fresh(struct wg_peer *peer)
 	send = keypair && READ_ONCE(keypair->sending.is_valid) &&
 	       keypair->i_am_the_initiator &&
 	       wg_birthdate_has_expired(keypair->sending.birthdate,
-			REJECT_AFTER_TIME - KEEPALIVE_TIMEOUT - REKEY_TIMEOUT);
+			REJECT_AFTER_TIME - peer->device->keepalive_timeout -
+			REKEY_TIMEOUT);
 	rcu_read_unlock_bh();
 
 	if (unlikely(send)) {
@@ -255,6 +271,7 @@ static bool decrypt_packet(struct sk_buff *skb, struct noise_keypair *keypair,
 	unsigned int offset;
 	int num_frags;
 
+	PACKET_CB(skb)->drop_reason = WGDROP_KEYPAIR_EXPIRED;
 	if (unlikely(!keypair))
 		return false;
 
@@ -277,6 +294,7 @@ static bool decrypt_packet(struct sk_buff *skb, struct noise_keypair *keypair,
 	num_frags = skb_cow_data(skb, 0, &trailer);
 	offset += sizeof(struct message_data);
 	skb_pull(skb, offset);
+	PACKET_CB(skb)->drop_reason = WGDROP_NOMEM;
 	if (unlikely(num_frags < 0 || num_frags > ARRAY_SIZE(sg)))
 		return false;
 
@@ -284,6 +302,7 @@ static bool decrypt_packet(struct sk_buff *skb, struct noise_keypair *keypair,
 	if (skb_to_sgvec(skb, sg, 0, skb->len) <= 0)
 		return false;
 
+	PACKET_CB(skb)->drop_reason = WGDROP_DECRYPT_FAILED;
 	if (!chacha20poly1305_decrypt_sg_inplace(sg, skb->len, NULL, 0,
 						 PACKET_CB(skb)->nonce,
 						 keypair->receiving.key,
@@ -294,6 +313,7 @@ static bool decrypt_packet(struct sk_buff *skb, struct noise_keypair *keypair,
 	 * keep endpoint information intact.
 	 */
 	skb_push(skb, offset);
+	PACKET_CB(skb)->drop_reason = WGDROP_NOMEM;
 	if (pskb_trim(skb, skb->len - noise_encrypted_len(0)))
 		return false;
 	skb_pull(skb, offset);
@@ -343,15 +363,12 @@ out:
 #include "selftest/counter.c"
 
 static void wg_packet_consume_data_done(struct wg_peer *peer,
-					struct sk_buff *skb,
-					struct endpoint *endpoint)
+					struct sk_buff *skb)
 {
 	struct net_device *dev = peer->device->dev;
 	unsigned int len, len_before_trim;
 	struct wg_peer *routed_peer;
 
-	wg_socket_set_peer_endpoint(peer, endpoint);
-
 	if (unlikely(wg_noise_received_with_keypair(&peer->keypairs,
 						    PACKET_CB(skb)->keypair))) {
 		wg_timers_handshake_complete(peer);
@@ -410,8 +427,10 @@ static void wg_packet_consume_data_done(struct wg_peer *peer,
 	if (unlikely(len > skb->len))
 		goto dishonest_packet_size;
 	len_before_trim = skb->len;
-	if (unlikely(pskb_trim(skb, len)))
-		goto packet_processed;
+	if (unlikely(pskb_trim(skb, len))) {
+		wg_packet_drop(peer->device, skb, WGDROP_NOMEM);
+		return;
+	}
 
 	routed_peer = wg_allowedips_lookup_src(&peer->device->peer_allowedips,
 					       skb);
@@ -430,19 +449,22 @@ dishonest_packet_peer:
 				&peer->endpoint.addr);
 	++dev->stats.rx_errors;
 	++dev->stats.rx_frame_errors;
-	goto packet_processed;
+	wg_packet_drop(peer->device, skb, WGDROP_UNALLOWED_SOURCE);
+	return;
 dishonest_packet_type:
 	net_dbg_ratelimited("%s: Packet is neither ipv4 nor ipv6 from peer %llu (%pISpfsc)\n",
 			    dev->name, peer->internal_id, &peer->endpoint.addr);
 	++dev->stats.rx_errors;
 	++dev->stats.rx_frame_errors;
-	goto packet_processed;
+	wg_packet_drop(peer->device, skb, WGDROP_INVALID_INNER_PACKET);
+	return;
 dishonest_packet_size:
 	net_dbg_ratelimited("%s: Packet has incorrect size from peer %llu (%pISpfsc)\n",
 			    dev->name, peer->internal_id, &peer->endpoint.addr);
 	++dev->stats.rx_errors;
 	++dev->stats.rx_length_errors;
-	goto packet_processed;
+	wg_packet_drop(peer->device, skb, WGDROP_INVALID_INNER_PACKET);
+	return;
 packet_processed:
 	dev_kfree_skb(skb);
 }
@@ -451,7 +473,6 @@ int wg_packet_rx_poll(struct napi_struct *napi, int budget)
 {
 	struct wg_peer *peer = container_of(napi, struct wg_peer, napi);
 	struct noise_keypair *keypair;
-	struct endpoint endpoint;
 	enum packet_state state;
 	struct sk_buff *skb;
 	int work_done = 0;
@@ -469,9 +490,14 @@ int wg_packet_rx_poll(struct napi_struct *napi, int budget)
 
 		if (unlikely(state != PACKET_STATE_CRYPTED))
 			goto next;
+		wg_latency_record(peer->device, skb,
+				  WGLATENCY_STAGE_RX_ORDERING);
 
 		if (unlikely(!counter_validate(&keypair->receiving_counter,
 					       PACKET_CB(skb)->nonce))) {
+			trace_wg_replay_reject(peer, keypair,
+					       PACKET_CB(skb)->nonce, skb->len);
+			PACKET_CB(skb)->drop_reason = WGDROP_REPLAYED;
 			net_dbg_ratelimited("%s: Packet has invalid nonce %llu (max %llu)\n",
 					    peer->device->dev->name,
 					    PACKET_CB(skb)->nonce,
@@ -479,18 +505,18 @@ int wg_packet_rx_poll(struct napi_struct *napi, int budget)
 			goto next;
 		}
 
-		if (unlikely(wg_socket_endpoint_from_skb(&endpoint, skb)))
-			goto next;
+		wg_socket_set_peer_endpoint_from_skb(peer, skb);
 
 		wg_reset_packet(skb, false);
-		wg_packet_consume_data_done(peer, skb, &endpoint);
+		wg_packet_consume_data_done(peer, skb);
 		free = false;
 
 next:
 		wg_noise_keypair_put(keypair, false);
 		wg_peer_put(peer);
 		if (unlikely(free))
-			dev_kfree_skb(skb);
+			wg_packet_drop(peer->device, skb,
+				       PACKET_CB(skb)->drop_reason);
 
 		if (++work_done >= budget)
 			break;
@@ -504,30 +530,45 @@ next:
 
 void wg_packet_decrypt_worker(struct work_struct *work)
 {
-	struct crypt_queue *queue = container_of(work, struct multicore_worker,
-						 work)->ptr;
+	struct multicore_worker *worker = container_of(work,
+						       struct multicore_worker,
+						       work);
+	struct crypt_queue *queue = worker->ptr;
 	simd_context_t simd_context;
 	struct sk_buff *skb;
+	u64 start = ktime_get_ns();
 
+	wg_packet_queue_sample(queue);
 	simd_get(&simd_context);
 	while ((skb = ptr_ring_consume_bh(&queue->ring)) != NULL) {
-		enum packet_state state =
-			likely(decrypt_packet(skb, PACKET_CB(skb)->keypair,
+		struct wg_device *wg = PACKET_PEER(skb)->device;
+		enum packet_state state;
+
+		wg_latency_record(wg, skb, WGLATENCY_STAGE_RX_DECRYPT_QUEUE);
+		state = likely(decrypt_packet(skb, PACKET_CB(skb)->keypair,
 					      &simd_context)) ?
 				PACKET_STATE_CRYPTED : PACKET_STATE_DEAD;
+		if (likely(state == PACKET_STATE_CRYPTED))
+			trace_wg_decrypted(PACKET_PEER(skb),
+					   PACKET_CB(skb)->keypair,
+					   PACKET_CB(skb)->nonce, skb->len);
+		wg_latency_record(wg, skb, WGLATENCY_STAGE_RX_DECRYPT);
 		wg_queue_enqueue_per_peer_rx(skb, state);
 		simd_relax(&simd_context);
 	}
 
 	simd_put(&simd_context);
+	wg_worker_account_busy(worker, start);
 }
 
 static void wg_packet_consume_data(struct wg_device *wg, struct sk_buff *skb)
 {
 	__le32 idx = ((struct message_data *)skb->data)->key_idx;
+	enum wgdrop_reason reason = WGDROP_UNKNOWN_KEYPAIR;
 	struct wg_peer *peer = NULL;
 	int ret;
 
+	wg_latency_stamp(wg, skb);
 	rcu_read_lock_bh();
 	PACKET_CB(skb)->keypair =
 		(struct noise_keypair *)wg_index_hashtable_lookup(
@@ -536,27 +577,36 @@ static void wg_packet_consume_data(struct wg_device *wg, struct sk_buff *skb)
 	if (unlikely(!wg_noise_keypair_get(PACKET_CB(skb)->keypair)))
 		goto err_keypair;
 
+	reason = WGDROP_PEER_DEAD;
 	if (unlikely(READ_ONCE(peer->is_dead)))
 		goto err;
 
+	trace_wg_rx(peer, PACKET_CB(skb)->keypair,
+		    le64_to_cpu(((struct message_data *)skb->data)->counter),
+		    skb->len);
 	ret = wg_queue_enqueue_per_device_and_peer(&wg->decrypt_queue, &peer->rx_queue, skb,
 						   wg->packet_crypt_wq, &wg->decrypt_queue.last_cpu);
-	if (unlikely(ret == -EPIPE))
+	if (unlikely(ret == -EPIPE)) {
+		PACKET_CB(skb)->drop_reason = WGDROP_RX_RING_FULL;
 		wg_queue_enqueue_per_peer_rx(skb, PACKET_STATE_DEAD);
+	}
 	if (likely(!ret || ret == -EPIPE)) {
 		rcu_read_unlock_bh();
 		return;
 	}
+	reason = WGDROP_RX_QUEUE_FULL;
 err:
 	wg_noise_keypair_put(PACKET_CB(skb)->keypair, false);
 err_keypair:
 	rcu_read_unlock_bh();
 	wg_peer_put(peer);
-	dev_kfree_skb(skb);
+	wg_packet_drop(wg, skb, reason);
 }
 
 void wg_packet_receive(struct wg_device *wg, struct sk_buff *skb)
 {
+	enum wgdrop_reason reason = WGDROP_INVALID_HEADER;
+
 	if (unlikely(prepare_skb_header(skb, wg) < 0))
 		goto err;
 	switch (SKB_TYPE_LE32(skb)) {
@@ -564,10 +614,13 @@ void wg_packet_receive(struct wg_device *wg, struct sk_buff *skb)
 	case cpu_to_le32(MESSAGE_HANDSHAKE_RESPONSE):
 	case cpu_to_le32(MESSAGE_HANDSHAKE_COOKIE): {
 		int cpu, ret = -EBUSY;
+		unsigned int len;
 
+		reason = WGDROP_RNG_NOT_READY;
 		if (unlikely(!rng_is_initialized()))
 			goto drop;
-		if (atomic_read(&wg->handshake_queue_len) > MAX_QUEUED_INCOMING_HANDSHAKES / 2) {
+		reason = WGDROP_HANDSHAKE_QUEUE_FULL;
+		if (atomic_read(&wg->handshake_queue_len) > wg->max_queued_handshakes / 2) {
 			if (spin_trylock_bh(&wg->handshake_queue.ring.producer_lock)) {
 				ret = __ptr_ring_produce(&wg->handshake_queue.ring, skb);
 				spin_unlock_bh(&wg->handshake_queue.ring.producer_lock);
@@ -580,7 +633,9 @@ void wg_packet_receive(struct wg_device *wg, struct sk_buff *skb)
 						wg->dev->name, skb);
 			goto err;
 		}
-		atomic_inc(&wg->handshake_queue_len);
+		len = atomic_inc_return(&wg->handshake_queue_len);
+		if (unlikely(len > READ_ONCE(wg->handshake_queue.peak)))
+			WRITE_ONCE(wg->handshake_queue.peak, len);
 		cpu = wg_cpumask_next_online(&wg->handshake_queue.last_cpu);
 		/* Queues up a call to packet_process_queued_handshake_packets(skb): */
 		queue_work_on(cpu, wg->handshake_receive_wq,
@@ -598,5 +653,5 @@ void wg_packet_receive(struct wg_device *wg, struct sk_buff *skb)
 	return;
 
 err:
-	dev_kfree_skb(skb);
+	wg_packet_drop(wg, skb, reason);
 }
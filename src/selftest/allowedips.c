@@ -10,15 +10,23 @@
  * to graphviz (the dot command) to visualize it. If you define the macro
  * DEBUG_RANDOM_TRIE to be 1, then there will be an extremely costly set of
  * randomized tests done against a trivial implementation, which may take
- * upwards of a half-hour to complete. There's no set of users who should be
- * enabling these, and the only developers that should go anywhere near these
- * nobs are the ones who are reading this comment.
+ * upwards of a half-hour to complete. If you define the macro
+ * DEBUG_BENCHMARK_TRIE to be 1, then tables of realistic sizes and shapes will
+ * be loaded, timing insertion, lookups by destination and by source, and
+ * removal, and reporting the memory used by the trie and the number of nodes
+ * left for RCU to free, which takes a few seconds and a few hundred megabytes.
+ * There's no set of users who should be enabling these, and the only
+ * developers that should go anywhere near these nobs are the ones who are
+ * reading this comment.
  */
 
 #ifdef DEBUG
 
 #include <linux/siphash.h>
 
+/* Moving a node between peers bumps the generation of its previous owner. */
+static struct wg_device selftest_device __initdata;
+
 static __init void print_node(struct allowedips_node *node, u8 bits)
 {
 	char *fmt_connection = KERN_DEBUG "\t\"%p/%d\" -> \"%p/%d\";\n";
@@ -277,6 +285,7 @@ static __init bool randomized_test(void)
 			pr_err("allowedips random self-test malloc: FAIL\n");
 			goto free;
 		}
+		peers[i]->device = &selftest_device;
 		kref_init(&peers[i]->refcount);
 		INIT_LIST_HEAD(&peers[i]->allowedips_list);
 	}
@@ -452,11 +461,283 @@ static __init struct wg_peer *init_peer(void)
 
 	if (!peer)
 		return NULL;
+	peer->device = &selftest_device;
 	kref_init(&peer->refcount);
 	INIT_LIST_HEAD(&peer->allowedips_list);
 	return peer;
 }
 
+/* The share of prefixes of each length, in thousandths, roughly as seen in the
+ * IPv4 and IPv6 default-free zones.
+ */
+struct bench_prefix_share {
+	u8 cidr;
+	u16 share;
+};
+
+static const struct bench_prefix_share bench_dfz4[] __initconst = {
+	{ 8, 1 }, { 12, 1 }, { 14, 2 }, { 15, 2 }, { 16, 14 }, { 17, 9 },
+	{ 18, 15 }, { 19, 25 }, { 20, 40 }, { 21, 45 }, { 22, 125 }, { 23, 100 },
+	{ 24, 581 }
+};
+
+static const struct bench_prefix_share bench_dfz6[] __initconst = {
+	{ 28, 5 }, { 29, 30 }, { 32, 120 }, { 33, 10 }, { 34, 10 }, { 35, 5 },
+	{ 36, 40 }, { 40, 60 }, { 42, 20 }, { 44, 80 }, { 45, 20 }, { 46, 40 },
+	{ 47, 30 }, { 48, 530 }
+};
+
+enum {
+	BENCH_DFZ_ROUTES4 = 950000,
+	BENCH_DFZ_ROUTES6 = 200000,
+	BENCH_DFZ_PEERS = 1000,
+	BENCH_HOST_PEERS = 10000,
+	BENCH_LOOKUPS = 1 << 20
+};
+
+struct bench_route {
+	u8 ip[16] __aligned(__alignof(u64));
+	u8 cidr;
+	unsigned int peer;
+};
+
+static __init u8 bench_pick_cidr(const struct bench_prefix_share *shares,
+				 size_t len)
+{
+	unsigned int r = prandom_u32_max(1000);
+	size_t i;
+
+	for (i = 0; i < len - 1; ++i) {
+		if (r < shares[i].share)
+			break;
+		r -= shares[i].share;
+	}
+	return shares[i].cidr;
+}
+
+/* Random prefixes of the zone's lengths, out of 2000::/3 for IPv6, with a few
+ * peers getting most of them, as though a handful of them were transit and
+ * the rest were smaller networks.
+ */
+static __init void bench_dfz_route(struct bench_route *route, u8 bits,
+				   unsigned int i, unsigned int peers)
+{
+	prandom_bytes(route->ip, bits / 8);
+	if (bits == 32) {
+		route->cidr = bench_pick_cidr(bench_dfz4, ARRAY_SIZE(bench_dfz4));
+	} else {
+		route->cidr = bench_pick_cidr(bench_dfz6, ARRAY_SIZE(bench_dfz6));
+		route->ip[0] = 0x20 | (route->ip[0] & 0x1f);
+	}
+	route->peer = prandom_u32_max(prandom_u32_max(peers) + 1);
+}
+
+/* A single address of each family for every peer, as on a server for many
+ * clients.
+ */
+static __init void bench_host_route(struct bench_route *route, u8 bits,
+				    unsigned int i, unsigned int peers)
+{
+	__be32 host = cpu_to_be32(i + 1);
+
+	memset(route->ip, 0, sizeof(route->ip));
+	if (bits == 32) {
+		route->ip[0] = 10;
+		memcpy(route->ip + 1, (u8 *)&host + 1, 3);
+	} else {
+		route->ip[0] = 0xfd;
+		memcpy(route->ip + 12, &host, 4);
+	}
+	route->cidr = bits;
+	route->peer = i % peers;
+}
+
+static __init size_t bench_count_nodes(struct allowedips_node *node)
+{
+	if (!node)
+		return 0;
+	return 1 + bench_count_nodes(rcu_dereference_raw(node->bit[0])) +
+	       bench_count_nodes(rcu_dereference_raw(node->bit[1]));
+}
+
+/* Times lookups of addresses inside of random routes, so that every lookup
+ * walks the trie down to a match, just like traffic does.
+ */
+static __init bool bench_lookups(struct allowedips *t,
+				 const struct bench_route *routes,
+				 unsigned int len, u8 bits, u64 *dst_ns,
+				 u64 *src_ns)
+{
+	unsigned int i, j, misses = 0;
+	struct sk_buff *skb;
+	u8 *addrs, *daddr, *saddr;
+	u64 start;
+
+	addrs = kvmalloc_array(BENCH_LOOKUPS, bits / 8, GFP_KERNEL);
+	skb = alloc_skb(sizeof(struct ipv6hdr), GFP_KERNEL);
+	if (unlikely(!addrs || !skb)) {
+		kvfree(addrs);
+		kfree_skb(skb);
+		return false;
+	}
+	for (i = 0; i < BENCH_LOOKUPS; ++i) {
+		const struct bench_route *route = &routes[prandom_u32_max(len)];
+		u8 *addr = addrs + i * (bits / 8);
+
+		prandom_bytes(addr, bits / 8);
+		for (j = 0; j < bits / 8; ++j) {
+			u8 mask = j * 8 + 8 <= route->cidr ? 0xff :
+				  j * 8 >= route->cidr ? 0 :
+				  0xff << (8 - route->cidr % 8);
+
+			addr[j] = (route->ip[j] & mask) | (addr[j] & ~mask);
+		}
+	}
+
+	skb_reset_network_header(skb);
+	skb_put_zero(skb, sizeof(struct ipv6hdr));
+	if (bits == 32) {
+		skb->protocol = htons(ETH_P_IP);
+		daddr = (u8 *)&ip_hdr(skb)->daddr;
+		saddr = (u8 *)&ip_hdr(skb)->saddr;
+	} else {
+		skb->protocol = htons(ETH_P_IPV6);
+		daddr = (u8 *)&ipv6_hdr(skb)->daddr;
+		saddr = (u8 *)&ipv6_hdr(skb)->saddr;
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_LOOKUPS; ++i) {
+		memcpy(daddr, addrs + i * (bits / 8), bits / 8);
+		misses += !wg_allowedips_lookup_dst(t, skb);
+	}
+	*dst_ns = div_u64(ktime_get_ns() - start, BENCH_LOOKUPS);
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_LOOKUPS; ++i) {
+		memcpy(saddr, addrs + i * (bits / 8), bits / 8);
+		misses += !wg_allowedips_lookup_src(t, skb);
+	}
+	*src_ns = div_u64(ktime_get_ns() - start, BENCH_LOOKUPS);
+
+	kfree_skb(skb);
+	kvfree(addrs);
+	return !misses;
+}
+
+static __init bool bench_table(const char *name, unsigned int num_peers,
+			       unsigned int num_routes4,
+			       unsigned int num_routes6,
+			       void (*make_route)(struct bench_route *route,
+						  u8 bits, unsigned int i,
+						  unsigned int peers))
+{
+	const unsigned int num_routes[] = { num_routes4, num_routes6 };
+	unsigned int i, family, bits, nodes_freed = 0;
+	u64 start, insert_ns, remove_ns, dst_ns, src_ns;
+	struct bench_route *routes = NULL;
+	struct wg_peer **peers;
+	DEFINE_MUTEX(mutex);
+	struct allowedips t;
+	size_t nodes;
+	bool ret = false;
+	int err;
+
+	mutex_init(&mutex);
+	wg_allowedips_init(&t);
+
+	peers = kcalloc(num_peers, sizeof(*peers), GFP_KERNEL);
+	if (unlikely(!peers))
+		goto free;
+	for (i = 0; i < num_peers; ++i) {
+		peers[i] = init_peer();
+		if (unlikely(!peers[i]))
+			goto free;
+	}
+	routes = kvmalloc_array(max(num_routes4, num_routes6), sizeof(*routes),
+				GFP_KERNEL);
+	if (unlikely(!routes))
+		goto free;
+
+	for (family = 0; family < 2; ++family) {
+		bits = family ? 128 : 32;
+		for (i = 0; i < num_routes[family]; ++i)
+			make_route(&routes[i], bits, i, num_peers);
+
+		mutex_lock(&mutex);
+		start = ktime_get_ns();
+		for (i = 0; i < num_routes[family]; ++i) {
+			if (bits == 32)
+				err = wg_allowedips_insert_v4(&t,
+					(struct in_addr *)routes[i].ip,
+					routes[i].cidr, peers[routes[i].peer],
+					&mutex);
+			else
+				err = wg_allowedips_insert_v6(&t,
+					(struct in6_addr *)routes[i].ip,
+					routes[i].cidr, peers[routes[i].peer],
+					&mutex);
+			if (unlikely(err < 0)) {
+				mutex_unlock(&mutex);
+				goto free;
+			}
+			cond_resched();
+		}
+		insert_ns = div_u64(ktime_get_ns() - start, num_routes[family]);
+		mutex_unlock(&mutex);
+
+		if (!bench_lookups(&t, routes, num_routes[family], bits,
+				   &dst_ns, &src_ns))
+			goto free;
+		nodes = bench_count_nodes(rcu_dereference_raw(
+					family ? t.root6 : t.root4));
+		nodes_freed += nodes;
+		pr_info("allowedips benchmark %s v%d: %u routes, %u peers, insert %llu ns/op, lookup dst %llu ns/op, src %llu ns/op, %zu nodes, %zu KiB\n",
+			name, family ? 6 : 4, num_routes[family], num_peers,
+			insert_ns, dst_ns, src_ns, nodes,
+			nodes * kmem_cache_size(node_cache) / 1024);
+	}
+
+	/* Each node is handed to call_rcu on its own, so the barrier shows how
+	 * long RCU takes to catch up with a removal of this size.
+	 */
+	mutex_lock(&mutex);
+	start = ktime_get_ns();
+	for (i = 0; i < num_peers; ++i) {
+		wg_allowedips_remove_by_peer(&t, peers[i], &mutex);
+		cond_resched();
+	}
+	remove_ns = ktime_get_ns() - start;
+	mutex_unlock(&mutex);
+	start = ktime_get_ns();
+	rcu_barrier();
+	pr_info("allowedips benchmark %s: removal %llu ns/route, %u nodes freed by RCU, rcu_barrier %llu us\n",
+		name, div_u64(remove_ns, num_routes4 + num_routes6),
+		nodes_freed, div_u64(ktime_get_ns() - start, NSEC_PER_USEC));
+	ret = !t.root4 && !t.root6;
+
+free:
+	if (!ret)
+		pr_err("allowedips benchmark %s: FAIL\n", name);
+	mutex_lock(&mutex);
+	wg_allowedips_free(&t, &mutex);
+	mutex_unlock(&mutex);
+	kvfree(routes);
+	if (peers) {
+		for (i = 0; i < num_peers; ++i)
+			kfree(peers[i]);
+	}
+	kfree(peers);
+	return ret;
+}
+
+static __init bool benchmark(void)
+{
+	return bench_table("dfz", BENCH_DFZ_PEERS, BENCH_DFZ_ROUTES4,
+			   BENCH_DFZ_ROUTES6, bench_dfz_route) &&
+	       bench_table("hosts", BENCH_HOST_PEERS, BENCH_HOST_PEERS,
+			   BENCH_HOST_PEERS, bench_host_route);
+}
+
 #define insert(version, mem, ipa, ipb, ipc, ipd, cidr)                       \
 	wg_allowedips_insert_v##version(&t, ip##version(ipa, ipb, ipc, ipd), \
 					cidr, mem, &mutex)
@@ -649,6 +930,9 @@ bool __init wg_allowedips_selftest(void)
 	if (IS_ENABLED(DEBUG_RANDOM_TRIE) && success)
 		success = randomized_test();
 
+	if (IS_ENABLED(DEBUG_BENCHMARK_TRIE) && success)
+		success = benchmark();
+
 	if (success)
 		pr_info("allowedips self-tests: pass\n");
 
@@ -1,11 +1,24 @@
 // SPDX-License-Identifier: GPL-2.0
 /*
  * Copyright (C) 2015-2019 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+ *
+ * If you define the macro DEBUG_BENCHMARK_RATELIMITER to be 1, then after the
+ * tests below pass, wg_ratelimiter_allow() and wg_cookie_validate_packet() will
+ * be timed on one CPU and then on all of them at once, for a handful of
+ * sources, for millions of spoofed ones, and for IPv6 sources within one /64
+ * and across many. Lock contention shows up as the difference between the two
+ * per-call times, since all CPUs hammer the same entries, table lock, entry
+ * counter and cookie secret lock.
  */
 
 #ifdef DEBUG
 
+#include "cookie.h"
+#include "device.h"
+
 #include <linux/jiffies.h>
+#include <linux/udp.h>
+#include <zinc/blake2s.h>
 
 static const struct {
 	bool result;
@@ -115,6 +128,296 @@ static __init int capacity_test(struct sk_buff *skb4, struct iphdr *hdr4,
 	return 0;
 }
 
+enum {
+	BENCH_CALLS = 1 << 20,
+	BENCH_FEW_SOURCES = 4
+};
+
+enum bench_packet {
+	BENCH_IPV4,
+	BENCH_IPV6,
+	BENCH_INVALID_MAC1,
+	BENCH_NO_COOKIE,
+	BENCH_VALID_COOKIE
+};
+
+struct bench_worker {
+	struct work_struct work;
+	struct bench_run *run;
+	struct sk_buff *skb;
+	unsigned int cpu, allowed;
+	u64 ns;
+};
+
+struct bench_scenario {
+	const char *name;
+	enum bench_packet packet;
+	bool (*call)(struct bench_worker *worker, unsigned int i);
+};
+
+struct bench_run {
+	const struct bench_scenario *scenario;
+	struct cookie_checker *checker;
+	unsigned int workers;
+	atomic_t ready;
+};
+
+/* Spreads the spoofed sources of each CPU over the address space, without
+ * repeating any within a run.
+ */
+static __init u32 bench_spoof(struct bench_worker *worker, unsigned int i)
+{
+	return (worker->cpu << 24) ^ (i * 2654435761U);
+}
+
+static __init bool bench_few4(struct bench_worker *worker, unsigned int i)
+{
+	ip_hdr(worker->skb)->saddr = htonl(0x0a000001 + i % BENCH_FEW_SOURCES);
+	return wg_ratelimiter_allow(worker->skb, &init_net);
+}
+
+static __init bool bench_spoofed4(struct bench_worker *worker, unsigned int i)
+{
+	ip_hdr(worker->skb)->saddr = htonl(bench_spoof(worker, i));
+	return wg_ratelimiter_allow(worker->skb, &init_net);
+}
+
+static __init bool bench_one64(struct bench_worker *worker, unsigned int i)
+{
+	ipv6_hdr(worker->skb)->saddr.in6_u.u6_addr32[3] =
+		htonl(bench_spoof(worker, i));
+	return wg_ratelimiter_allow(worker->skb, &init_net);
+}
+
+static __init bool bench_spoofed64(struct bench_worker *worker, unsigned int i)
+{
+	ipv6_hdr(worker->skb)->saddr.in6_u.u6_addr32[1] =
+		htonl(bench_spoof(worker, i));
+	return wg_ratelimiter_allow(worker->skb, &init_net);
+}
+
+static __init bool bench_cookie(struct bench_worker *worker, unsigned int i)
+{
+	return wg_cookie_validate_packet(worker->run->checker, worker->skb,
+					 true) == VALID_MAC_WITH_COOKIE;
+}
+
+static const struct bench_scenario bench_scenarios[] __initconst = {
+	{ "few sources", BENCH_IPV4, bench_few4 },
+	{ "spoofed sources", BENCH_IPV4, bench_spoofed4 },
+#if IS_ENABLED(CONFIG_IPV6)
+	{ "one /64", BENCH_IPV6, bench_one64 },
+	{ "spoofed /64s", BENCH_IPV6, bench_spoofed64 },
+#endif
+	{ "cookie, invalid mac1", BENCH_INVALID_MAC1, bench_cookie },
+	{ "cookie, no cookie", BENCH_NO_COOKIE, bench_cookie },
+	{ "cookie, valid", BENCH_VALID_COOKIE, bench_cookie }
+};
+
+/* Builds an initiation as it arrives from one of a few sources, with its MACs
+ * computed the same way as in cookie.c, or left as garbage.
+ */
+static __init struct sk_buff *bench_initiation(struct cookie_checker *checker,
+					       enum bench_packet packet,
+					       unsigned int cpu)
+{
+	struct message_handshake_initiation *message;
+	struct blake2s_state state;
+	u8 cookie[COOKIE_LEN];
+	struct sk_buff *skb;
+	struct udphdr *udp;
+	struct iphdr *hdr4;
+
+	skb = alloc_skb(sizeof(*hdr4) + sizeof(*udp) + sizeof(*message),
+			GFP_KERNEL);
+	if (unlikely(!skb))
+		return NULL;
+	skb->protocol = htons(ETH_P_IP);
+	hdr4 = skb_put_zero(skb, sizeof(*hdr4) + sizeof(*udp) + sizeof(*message));
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(*hdr4));
+	hdr4->version = 4;
+	hdr4->ihl = sizeof(*hdr4) / 4;
+	hdr4->saddr = htonl(0x0a000001 + cpu % BENCH_FEW_SOURCES);
+	udp = udp_hdr(skb);
+	udp->source = htons(51820);
+	message = (struct message_handshake_initiation *)
+		skb_pull(skb, sizeof(*hdr4) + sizeof(*udp));
+	prandom_bytes(message, sizeof(*message));
+	message->header.type = cpu_to_le32(MESSAGE_HANDSHAKE_INITIATION);
+	if (packet == BENCH_INVALID_MAC1)
+		return skb;
+
+	blake2s(message->macs.mac1, (u8 *)message, checker->message_mac1_key,
+		COOKIE_LEN, offsetof(typeof(*message), macs.mac1),
+		NOISE_SYMMETRIC_KEY_LEN);
+	if (packet != BENCH_VALID_COOKIE)
+		return skb;
+
+	blake2s_init_key(&state, COOKIE_LEN, checker->secret, NOISE_HASH_LEN);
+	blake2s_update(&state, (u8 *)&hdr4->saddr, sizeof(hdr4->saddr));
+	blake2s_update(&state, (u8 *)&udp->source, sizeof(udp->source));
+	blake2s_final(&state, cookie);
+	blake2s(message->macs.mac2, (u8 *)message, cookie, COOKIE_LEN,
+		offsetof(typeof(*message), macs.mac2), COOKIE_LEN);
+	return skb;
+}
+
+static __init struct sk_buff *bench_packet(struct cookie_checker *checker,
+					   enum bench_packet packet,
+					   unsigned int cpu)
+{
+	struct ipv6hdr *hdr6;
+	struct sk_buff *skb;
+
+	if (packet == BENCH_IPV4) {
+		skb = alloc_skb(sizeof(struct iphdr), GFP_KERNEL);
+		if (unlikely(!skb))
+			return NULL;
+		skb->protocol = htons(ETH_P_IP);
+		skb_put_zero(skb, sizeof(struct iphdr));
+		skb_reset_network_header(skb);
+		return skb;
+	} else if (packet == BENCH_IPV6) {
+		skb = alloc_skb(sizeof(*hdr6), GFP_KERNEL);
+		if (unlikely(!skb))
+			return NULL;
+		skb->protocol = htons(ETH_P_IPV6);
+		hdr6 = skb_put_zero(skb, sizeof(*hdr6));
+		hdr6->saddr.in6_u.u6_addr32[0] = htonl(0x20010db8);
+		skb_reset_network_header(skb);
+		return skb;
+	}
+	return bench_initiation(checker, packet, cpu);
+}
+
+static __init void bench_worker_fn(struct work_struct *work)
+{
+	struct bench_worker *worker = container_of(work, struct bench_worker,
+						   work);
+	struct bench_run *run = worker->run;
+	unsigned int i;
+	u64 start;
+
+	/* Start all CPUs at once, so that they contend for the whole run. */
+	atomic_inc(&run->ready);
+	while (atomic_read(&run->ready) < run->workers)
+		cpu_relax();
+
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_CALLS; ++i) {
+		worker->allowed += run->scenario->call(worker, i);
+		if (!(i % 4096))
+			cond_resched();
+	}
+	worker->ns = ktime_get_ns() - start;
+}
+
+static __init bool bench_scenario(const struct bench_scenario *scenario,
+				  struct cookie_checker *checker,
+				  unsigned int workers, u64 *ns_per_call)
+{
+	struct bench_run run = {
+		.scenario = scenario,
+		.checker = checker,
+		.workers = workers,
+		.ready = ATOMIC_INIT(0)
+	};
+	struct bench_worker *worker;
+	u64 ns = 0, longest = 0, allowed = 0;
+	unsigned int i = 0;
+	bool ret = false;
+	int cpu;
+
+	worker = kcalloc(workers, sizeof(*worker), GFP_KERNEL);
+	if (unlikely(!worker))
+		return false;
+	for_each_online_cpu(cpu) {
+		if (i == workers)
+			break;
+		worker[i].run = &run;
+		worker[i].cpu = cpu;
+		worker[i].skb = bench_packet(checker, scenario->packet, cpu);
+		if (unlikely(!worker[i].skb))
+			goto out;
+		INIT_WORK(&worker[i].work, bench_worker_fn);
+		++i;
+	}
+	run.workers = workers = i;
+
+	wg_ratelimiter_gc_entries(NULL);
+	rcu_barrier();
+	for (i = 0; i < workers; ++i)
+		queue_work_on(worker[i].cpu, system_highpri_wq,
+			      &worker[i].work);
+	for (i = 0; i < workers; ++i) {
+		flush_work(&worker[i].work);
+		ns += worker[i].ns;
+		longest = max(longest, worker[i].ns);
+		allowed += worker[i].allowed;
+	}
+
+	*ns_per_call = div_u64(ns, workers * BENCH_CALLS);
+	pr_info("ratelimiter benchmark, %s: %u cpus, %llu ns/call, %llu calls/s, %llu allowed, %d of %u entries\n",
+		scenario->name, workers, *ns_per_call,
+		div64_u64((u64)workers * BENCH_CALLS * NSEC_PER_SEC,
+			  max_t(u64, longest, 1)),
+		allowed, atomic_read(&total_entries), max_entries);
+	ret = true;
+
+out:
+	for (i = 0; i < workers; ++i)
+		kfree_skb(worker[i].skb);
+	kfree(worker);
+	return ret;
+}
+
+static __init bool benchmark(void)
+{
+	struct cookie_checker checker;
+	struct wg_device *wg;
+	u64 alone, together;
+	bool ret = false;
+	unsigned int i;
+
+	/* Only the namespace of the device is used, as part of the ratelimiter
+	 * key, so a zeroed device will do.
+	 */
+	wg = kzalloc(sizeof(*wg), GFP_KERNEL);
+	if (unlikely(!wg))
+		goto out;
+	wg->dev = kzalloc(sizeof(*wg->dev), GFP_KERNEL);
+	if (unlikely(!wg->dev))
+		goto out;
+	wg_cookie_checker_init(&checker, wg);
+	get_random_bytes(checker.message_mac1_key, NOISE_SYMMETRIC_KEY_LEN);
+
+	for (i = 0; i < ARRAY_SIZE(bench_scenarios); ++i) {
+		if (!bench_scenario(&bench_scenarios[i], &checker, 1, &alone))
+			goto out;
+		if (num_online_cpus() == 1)
+			continue;
+		if (!bench_scenario(&bench_scenarios[i], &checker,
+				    num_online_cpus(), &together))
+			goto out;
+		pr_info("ratelimiter benchmark, %s: %lld%% slower per call with all cpus contending\n",
+			bench_scenarios[i].name,
+			div64_s64(((s64)together - (s64)alone) * 100,
+				  max_t(s64, alone, 1)));
+	}
+	ret = true;
+
+out:
+	wg_ratelimiter_gc_entries(NULL);
+	rcu_barrier();
+	if (wg)
+		kfree(wg->dev);
+	kfree(wg);
+	if (!ret)
+		pr_err("ratelimiter benchmark: FAIL\n");
+	return ret;
+}
+
 bool __init wg_ratelimiter_selftest(void)
 {
 	enum { TRIALS_BEFORE_GIVING_UP = 5000 };
@@ -202,6 +505,9 @@ bool __init wg_ratelimiter_selftest(void)
 		break;
 	}
 
+	if (IS_ENABLED(DEBUG_BENCHMARK_RATELIMITER) && !benchmark())
+		goto err;
+
 	success = true;
 
 err:
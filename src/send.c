@@ -10,6 +10,7 @@
 #include "socket.h"
 #include "messages.h"
 #include "cookie.h"
+#include "trace.h"
 
 #include <linux/simd.h>
 #include <linux/uio.h>
@@ -38,8 +39,11 @@ static void wg_packet_send_handshake_initiation(struct wg_peer *peer)
 		wg_timers_any_authenticated_packet_sent(peer);
 		atomic64_set(&peer->last_sent_handshake,
 			     ktime_get_coarse_boottime_ns());
+		/* A handshake is what makes a peer worth caching a route for. */
+		wg_socket_endpoint_cache_init(peer);
 		wg_socket_send_buffer_to_peer(peer, &packet, sizeof(packet),
 					      HANDSHAKE_DSCP);
+		trace_wg_handshake(peer, MESSAGE_HANDSHAKE_INITIATION, true);
 		wg_timers_handshake_initiated(peer);
 	}
 }
@@ -101,9 +105,12 @@ void wg_packet_send_handshake_response(struct wg_peer *peer)
 			wg_timers_any_authenticated_packet_sent(peer);
 			atomic64_set(&peer->last_sent_handshake,
 				     ktime_get_coarse_boottime_ns());
+			wg_socket_endpoint_cache_init(peer);
 			wg_socket_send_buffer_to_peer(peer, &packet,
 						      sizeof(packet),
 						      HANDSHAKE_DSCP);
+			trace_wg_handshake(peer, MESSAGE_HANDSHAKE_RESPONSE,
+					   true);
 		}
 	}
 }
@@ -120,6 +127,7 @@ void wg_packet_send_handshake_cookie(struct wg_device *wg,
 				 &wg->cookie_checker);
 	wg_socket_send_buffer_as_reply_to_skb(wg, initiating_skb, &packet,
 					      sizeof(packet));
+	trace_wg_handshake(NULL, MESSAGE_HANDSHAKE_COOKIE, true);
 }
 
 static void keep_key_fresh(struct wg_peer *peer)
@@ -233,6 +241,7 @@ void wg_packet_send_keepalive(struct wg_peer *peer)
 		skb_reserve(skb, DATA_PACKET_HEAD_ROOM);
 		skb->dev = peer->device->dev;
 		PACKET_CB(skb)->mtu = skb->dev->mtu;
+		wg_latency_stamp(peer->device, skb);
 		skb_queue_tail(&peer->staged_packet_queue, skb);
 		net_dbg_ratelimited("%s: Sending keepalive packet to peer %llu (%pISpfsc)\n",
 				    peer->device->dev->name, peer->internal_id,
@@ -245,18 +254,19 @@ void wg_packet_send_keepalive(struct wg_peer *peer)
 static void wg_packet_create_data_done(struct wg_peer *peer, struct sk_buff *first)
 {
 	struct sk_buff *skb, *next;
-	bool is_keepalive, data_sent = false;
+	bool has_data = false;
 
 	wg_timers_any_authenticated_packet_traversal(peer);
 	wg_timers_any_authenticated_packet_sent(peer);
 	skb_list_walk_safe(first, skb, next) {
-		is_keepalive = skb->len == message_data_len(0);
-		if (likely(!wg_socket_send_skb_to_peer(peer, skb,
-				PACKET_CB(skb)->ds) && !is_keepalive))
-			data_sent = true;
+		if (skb->len != message_data_len(0))
+			has_data = true;
+		trace_wg_tx(peer, PACKET_CB(first)->keypair,
+			    PACKET_CB(skb)->nonce, skb->len);
 	}
 
-	if (likely(data_sent))
+	/* The whole batch goes out over a single route lookup. */
+	if (likely(!wg_socket_send_skbs_to_peer(peer, first) && has_data))
 		wg_timers_data_sent(peer);
 
 	keep_key_fresh(peer);
@@ -275,10 +285,14 @@ void wg_packet_tx_worker(struct work_struct *work)
 		wg_prev_queue_drop_peeked(&peer->tx_queue);
 		keypair = PACKET_CB(first)->keypair;
 
-		if (likely(state == PACKET_STATE_CRYPTED))
+		if (likely(state == PACKET_STATE_CRYPTED)) {
+			wg_latency_record(peer->device, first,
+					  WGLATENCY_STAGE_TX_ORDERING);
 			wg_packet_create_data_done(peer, first);
-		else
-			kfree_skb_list(first);
+		} else {
+			wg_packet_drop_list(peer->device, first,
+					    PACKET_CB(first)->drop_reason);
+		}
 
 		wg_noise_keypair_put(keypair, false);
 		wg_peer_put(peer);
@@ -289,30 +303,44 @@ void wg_packet_tx_worker(struct work_struct *work)
 
 void wg_packet_encrypt_worker(struct work_struct *work)
 {
-	struct crypt_queue *queue = container_of(work, struct multicore_worker,
-						 work)->ptr;
+	struct multicore_worker *worker = container_of(work,
+						       struct multicore_worker,
+						       work);
+	struct crypt_queue *queue = worker->ptr;
 	struct sk_buff *first, *skb, *next;
 	simd_context_t simd_context;
+	u64 start = ktime_get_ns();
 
+	wg_packet_queue_sample(queue);
 	simd_get(&simd_context);
 	while ((first = ptr_ring_consume_bh(&queue->ring)) != NULL) {
+		struct wg_device *wg = PACKET_PEER(first)->device;
 		enum packet_state state = PACKET_STATE_CRYPTED;
 
+		wg_latency_record(wg, first, WGLATENCY_STAGE_TX_ENCRYPT_QUEUE);
 		skb_list_walk_safe(first, skb, next) {
 			if (likely(encrypt_packet(skb,
 						  PACKET_CB(first)->keypair,
 						  &simd_context))) {
+				trace_wg_encrypted(PACKET_PEER(first),
+						   PACKET_CB(first)->keypair,
+						   PACKET_CB(skb)->nonce,
+						   skb->len);
 				wg_reset_packet(skb, true);
 			} else {
+				PACKET_CB(first)->drop_reason =
+					WGDROP_TX_ENCRYPT_FAILED;
 				state = PACKET_STATE_DEAD;
 				break;
 			}
 		}
+		wg_latency_record(wg, first, WGLATENCY_STAGE_TX_ENCRYPT);
 		wg_queue_enqueue_per_peer_tx(first, state);
 
 		simd_relax(&simd_context);
 	}
 	simd_put(&simd_context);
+	wg_worker_account_busy(worker, start);
 }
 
 static void wg_packet_create_data(struct wg_peer *peer, struct sk_buff *first)
@@ -325,23 +353,30 @@ static void wg_packet_create_data(struct wg_peer *peer, struct sk_buff *first)
 		goto err;
 
 	ret = wg_queue_enqueue_per_device_and_peer(&wg->encrypt_queue, &peer->tx_queue, first,
-						   wg->packet_crypt_wq, &wg->encrypt_queue.last_cpu);
-	if (unlikely(ret == -EPIPE))
+						   wg->packet_crypt_wq,
+						   &wg->tx_queues[PACKET_CB(first)->txq].last_cpu);
+	if (unlikely(ret == -EPIPE)) {
+		PACKET_CB(first)->drop_reason = WGDROP_TX_RING_FULL;
 		wg_queue_enqueue_per_peer_tx(first, PACKET_STATE_DEAD);
+	}
 err:
 	rcu_read_unlock_bh();
 	if (likely(!ret || ret == -EPIPE))
 		return;
 	wg_noise_keypair_put(PACKET_CB(first)->keypair, false);
 	wg_peer_put(peer);
-	kfree_skb_list(first);
+	wg_packet_drop_list(wg, first, ret == -ENOSPC ?
+			    WGDROP_TX_QUEUE_FULL : WGDROP_PEER_DEAD);
 }
 
 void wg_packet_purge_staged_packets(struct wg_peer *peer)
 {
+	struct sk_buff *skb;
+
 	spin_lock_bh(&peer->staged_packet_queue.lock);
 	peer->device->dev->stats.tx_dropped += peer->staged_packet_queue.qlen;
-	__skb_queue_purge(&peer->staged_packet_queue);
+	while ((skb = __skb_dequeue(&peer->staged_packet_queue)) != NULL)
+		wg_packet_drop(peer->device, skb, WGDROP_FLUSHED);
 	spin_unlock_bh(&peer->staged_packet_queue.lock);
 }
 
@@ -386,8 +421,12 @@ void wg_packet_send_staged_packets(struct wg_peer *peer)
 				atomic64_inc_return(&keypair->sending_counter) - 1;
 		if (unlikely(PACKET_CB(skb)->nonce >= REJECT_AFTER_MESSAGES))
 			goto out_invalid;
+		trace_wg_staged(peer, keypair, PACKET_CB(skb)->nonce,
+				skb->len);
 	}
 
+	wg_latency_record(peer->device, packets.next,
+			  WGLATENCY_STAGE_TX_STAGED);
 	packets.prev->next = NULL;
 	wg_peer_get(keypair->entry.peer);
 	PACKET_CB(packets.next)->keypair = keypair;
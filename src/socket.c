@@ -8,6 +8,8 @@
 #include "socket.h"
 #include "queueing.h"
 #include "messages.h"
+#include "netlink.h"
+#include "trace.h"
 
 #include <linux/ctype.h>
 #include <linux/net.h>
@@ -17,8 +19,39 @@
 #include <net/udp_tunnel.h>
 #include <net/ipv6.h>
 
-static int send4(struct wg_device *wg, struct sk_buff *skb,
-		 struct endpoint *endpoint, u8 ds, struct dst_cache *cache)
+/* Packets of different inner flows are sent from, and to, different ports of
+ * their respective ranges, so that the outer flows, and therefore receive side
+ * scaling on either end, follow the inner ones. Handshakes and other packets
+ * without a flow hash always use the first port of each range.
+ */
+static struct sock *pick_sock(struct sock __rcu **socks, unsigned int count,
+			      const struct sk_buff *skb, struct sock *first)
+{
+	struct sock *sock = NULL;
+
+	if (count > 1 && skb->hash)
+		sock = rcu_dereference_bh(socks[reciprocal_scale(skb->hash,
+								 count)]);
+	return likely(sock) ? sock : first;
+}
+
+static __be16 pick_dport(const struct endpoint *endpoint, __be16 port,
+			 const struct sk_buff *skb)
+{
+	if (endpoint->port_count <= 1 || !skb->hash)
+		return port;
+	return htons(ntohs(port) + reciprocal_scale(skb->hash,
+						    endpoint->port_count));
+}
+
+/* These take a list of skbs for the same endpoint, which share a single route
+ * lookup, with each skb taking its own reference to it, the last one ours. The
+ * DSCP of each is in its PACKET_CB. An empty list only warms the cache, and
+ * isn't counted in its stats.
+ */
+static int send4(struct wg_device *wg, struct sk_buff *first,
+		 struct endpoint *endpoint, struct dst_cache *cache,
+		 struct endpoint_cache_stats __percpu *stats)
 {
 	struct flowi4 fl = {
 		.saddr = endpoint->src4.s_addr,
@@ -27,30 +60,35 @@ static int send4(struct wg_device *wg, struct sk_buff *skb,
 		.flowi4_mark = wg->fwmark,
 		.flowi4_proto = IPPROTO_UDP
 	};
+	struct sock *sock, *first_sock;
+	struct sk_buff *skb, *next;
 	struct rtable *rt = NULL;
-	struct sock *sock;
+	unsigned int count;
 	int ret = 0;
 
-	skb_mark_not_on_list(skb);
-	skb->dev = wg->dev;
-	skb->mark = wg->fwmark;
-
 	rcu_read_lock_bh();
-	sock = rcu_dereference_bh(wg->sock4);
+	count = READ_ONCE(wg->sock_count);
+	first_sock = rcu_dereference_bh(wg->sock4[0]);
 
-	if (unlikely(!sock)) {
+	if (unlikely(!first_sock)) {
 		ret = -ENONET;
 		goto err;
 	}
 
-	fl.fl4_sport = inet_sk(sock)->inet_sport;
+	fl.fl4_sport = inet_sk(first_sock)->inet_sport;
 
 	if (cache)
 		rt = dst_cache_get_ip4(cache, &fl.saddr);
+	if (stats && first) {
+		if (rt)
+			this_cpu_inc(stats->hits);
+		else
+			this_cpu_inc(stats->misses);
+	}
 
 	if (!rt) {
-		security_sk_classify_flow(sock, flowi4_to_flowi(&fl));
-		if (unlikely(!inet_confirm_addr(sock_net(sock), NULL, 0,
+		security_sk_classify_flow(first_sock, flowi4_to_flowi(&fl));
+		if (unlikely(!inet_confirm_addr(sock_net(first_sock), NULL, 0,
 						fl.saddr, RT_SCOPE_HOST))) {
 			endpoint->src4.s_addr = 0;
 			endpoint->src_if4 = 0;
@@ -58,7 +96,7 @@ static int send4(struct wg_device *wg, struct sk_buff *skb,
 			if (cache)
 				dst_cache_reset(cache);
 		}
-		rt = ip_route_output_flow(sock_net(sock), &fl, sock);
+		rt = ip_route_output_flow(sock_net(first_sock), &fl, first_sock);
 		if (unlikely(endpoint->src_if4 && ((IS_ERR(rt) &&
 			     PTR_ERR(rt) == -EINVAL) || (!IS_ERR(rt) &&
 			     rt->dst.dev->ifindex != endpoint->src_if4)))) {
@@ -69,7 +107,8 @@ static int send4(struct wg_device *wg, struct sk_buff *skb,
 				dst_cache_reset(cache);
 			if (!IS_ERR(rt))
 				ip_rt_put(rt);
-			rt = ip_route_output_flow(sock_net(sock), &fl, sock);
+			rt = ip_route_output_flow(sock_net(first_sock), &fl,
+						  first_sock);
 		}
 		if (IS_ERR(rt)) {
 			ret = PTR_ERR(rt);
@@ -81,21 +120,38 @@ static int send4(struct wg_device *wg, struct sk_buff *skb,
 			dst_cache_set_ip4(cache, &rt->dst, fl.saddr);
 	}
 
-	skb->ignore_df = 1;
-	udp_tunnel_xmit_skb(rt, sock, skb, fl.saddr, fl.daddr, ds,
-			    ip4_dst_hoplimit(&rt->dst), 0, fl.fl4_sport,
-			    fl.fl4_dport, false, false);
+	if (!first) {
+		ip_rt_put(rt);
+		goto out;
+	}
+
+	skb_list_walk_safe(first, skb, next) {
+		skb_mark_not_on_list(skb);
+		skb->dev = wg->dev;
+		skb->mark = wg->fwmark;
+		skb->ignore_df = 1;
+		sock = pick_sock(wg->sock4, count, skb, first_sock);
+		if (next)
+			dst_hold(&rt->dst);
+		udp_tunnel_xmit_skb(rt, sock, skb, fl.saddr, fl.daddr,
+				    PACKET_CB(skb)->ds,
+				    ip4_dst_hoplimit(&rt->dst), 0,
+				    inet_sk(sock)->inet_sport,
+				    pick_dport(endpoint, fl.fl4_dport, skb),
+				    false, false);
+	}
 	goto out;
 
 err:
-	kfree_skb(skb);
+	wg_packet_drop_list(wg, first, WGDROP_TX_NO_ROUTE);
 out:
 	rcu_read_unlock_bh();
 	return ret;
 }
 
-static int send6(struct wg_device *wg, struct sk_buff *skb,
-		 struct endpoint *endpoint, u8 ds, struct dst_cache *cache)
+static int send6(struct wg_device *wg, struct sk_buff *first,
+		 struct endpoint *endpoint, struct dst_cache *cache,
+		 struct endpoint_cache_stats __percpu *stats)
 {
 #if IS_ENABLED(CONFIG_IPV6)
 	struct flowi6 fl = {
@@ -107,37 +163,43 @@ static int send6(struct wg_device *wg, struct sk_buff *skb,
 		.flowi6_proto = IPPROTO_UDP
 		/* TODO: addr->sin6_flowinfo */
 	};
+	struct sock *sock, *first_sock;
 	struct dst_entry *dst = NULL;
-	struct sock *sock;
+	struct sk_buff *skb, *next;
+	unsigned int count;
 	int ret = 0;
 
-	skb_mark_not_on_list(skb);
-	skb->dev = wg->dev;
-	skb->mark = wg->fwmark;
-
 	rcu_read_lock_bh();
-	sock = rcu_dereference_bh(wg->sock6);
+	count = READ_ONCE(wg->sock_count);
+	first_sock = rcu_dereference_bh(wg->sock6[0]);
 
-	if (unlikely(!sock)) {
+	if (unlikely(!first_sock)) {
 		ret = -ENONET;
 		goto err;
 	}
 
-	fl.fl6_sport = inet_sk(sock)->inet_sport;
+	fl.fl6_sport = inet_sk(first_sock)->inet_sport;
 
 	if (cache)
 		dst = dst_cache_get_ip6(cache, &fl.saddr);
+	if (stats && first) {
+		if (dst)
+			this_cpu_inc(stats->hits);
+		else
+			this_cpu_inc(stats->misses);
+	}
 
 	if (!dst) {
-		security_sk_classify_flow(sock, flowi6_to_flowi(&fl));
+		security_sk_classify_flow(first_sock, flowi6_to_flowi(&fl));
 		if (unlikely(!ipv6_addr_any(&fl.saddr) &&
-			     !ipv6_chk_addr(sock_net(sock), &fl.saddr, NULL, 0))) {
+			     !ipv6_chk_addr(sock_net(first_sock), &fl.saddr,
+					    NULL, 0))) {
 			endpoint->src6 = fl.saddr = in6addr_any;
 			if (cache)
 				dst_cache_reset(cache);
 		}
-		dst = ipv6_stub->ipv6_dst_lookup_flow(sock_net(sock), sock, &fl,
-						      NULL);
+		dst = ipv6_stub->ipv6_dst_lookup_flow(sock_net(first_sock),
+						      first_sock, &fl, NULL);
 		if (IS_ERR(dst)) {
 			ret = PTR_ERR(dst);
 			net_dbg_ratelimited("%s: No route to %pISpfsc, error %d\n",
@@ -148,39 +210,68 @@ static int send6(struct wg_device *wg, struct sk_buff *skb,
 			dst_cache_set_ip6(cache, dst, &fl.saddr);
 	}
 
-	skb->ignore_df = 1;
-	udp_tunnel6_xmit_skb(dst, sock, skb, skb->dev, &fl.saddr, &fl.daddr, ds,
-			     ip6_dst_hoplimit(dst), 0, fl.fl6_sport,
-			     fl.fl6_dport, false);
+	if (!first) {
+		dst_release(dst);
+		goto out;
+	}
+
+	skb_list_walk_safe(first, skb, next) {
+		skb_mark_not_on_list(skb);
+		skb->dev = wg->dev;
+		skb->mark = wg->fwmark;
+		skb->ignore_df = 1;
+		sock = pick_sock(wg->sock6, count, skb, first_sock);
+		if (next)
+			dst_hold(dst);
+		udp_tunnel6_xmit_skb(dst, sock, skb, skb->dev, &fl.saddr,
+				     &fl.daddr, PACKET_CB(skb)->ds,
+				     ip6_dst_hoplimit(dst), 0,
+				     inet_sk(sock)->inet_sport,
+				     pick_dport(endpoint, fl.fl6_dport, skb),
+				     false);
+	}
 	goto out;
 
 err:
-	kfree_skb(skb);
+	wg_packet_drop_list(wg, first, WGDROP_TX_NO_ROUTE);
 out:
 	rcu_read_unlock_bh();
 	return ret;
 #else
-	kfree_skb(skb);
+	wg_packet_drop_list(wg, first, WGDROP_TX_NO_ENDPOINT);
 	return -EAFNOSUPPORT;
 #endif
 }
 
-int wg_socket_send_skb_to_peer(struct wg_peer *peer, struct sk_buff *skb, u8 ds)
+/* Sends a list of skbs to the peer, with their DSCP in each PACKET_CB. */
+int wg_socket_send_skbs_to_peer(struct wg_peer *peer, struct sk_buff *first)
 {
-	size_t skb_len = skb->len;
+	struct endpoint_cache *cache;
+	struct sk_buff *skb, *next;
+	size_t len = 0;
 	int ret = -EAFNOSUPPORT;
 
+	skb_list_walk_safe(first, skb, next)
+		len += skb->len;
+
 	read_lock_bh(&peer->endpoint_lock);
+	/* A peer without a route cache, because it hasn't sent a handshake
+	 * since going idle or because allocating one failed, gets a full route
+	 * lookup for every list, which neither counts as a hit nor as a miss.
+	 */
+	cache = peer->endpoint_cache;
 	if (peer->endpoint.addr.sa_family == AF_INET)
-		ret = send4(peer->device, skb, &peer->endpoint, ds,
-			    &peer->endpoint_cache);
+		ret = send4(peer->device, first, &peer->endpoint,
+			    cache ? &cache->dst : NULL,
+			    cache ? cache->stats : NULL);
 	else if (peer->endpoint.addr.sa_family == AF_INET6)
-		ret = send6(peer->device, skb, &peer->endpoint, ds,
-			    &peer->endpoint_cache);
+		ret = send6(peer->device, first, &peer->endpoint,
+			    cache ? &cache->dst : NULL,
+			    cache ? cache->stats : NULL);
 	else
-		dev_kfree_skb(skb);
+		wg_packet_drop_list(peer->device, first, WGDROP_TX_NO_ENDPOINT);
 	if (likely(!ret))
-		peer->tx_bytes += skb_len;
+		peer->tx_bytes += len;
 	read_unlock_bh(&peer->endpoint_lock);
 
 	return ret;
@@ -197,7 +288,8 @@ int wg_socket_send_buffer_to_peer(struct wg_peer *peer, void *buffer,
 	skb_reserve(skb, SKB_HEADER_LEN);
 	skb_set_inner_network_header(skb, 0);
 	skb_put_data(skb, buffer, len);
-	return wg_socket_send_skb_to_peer(peer, skb, ds);
+	PACKET_CB(skb)->ds = ds;
+	return wg_socket_send_skbs_to_peer(peer, skb);
 }
 
 int wg_socket_send_buffer_as_reply_to_skb(struct wg_device *wg,
@@ -222,9 +314,9 @@ int wg_socket_send_buffer_as_reply_to_skb(struct wg_device *wg,
 	skb_put_data(skb, buffer, len);
 
 	if (endpoint.addr.sa_family == AF_INET)
-		ret = send4(wg, skb, &endpoint, 0, NULL);
+		ret = send4(wg, skb, &endpoint, NULL, NULL);
 	else if (endpoint.addr.sa_family == AF_INET6)
-		ret = send6(wg, skb, &endpoint, 0, NULL);
+		ret = send6(wg, skb, &endpoint, NULL, NULL);
 	/* No other possibilities if the endpoint is valid, which it is,
 	 * as we checked above.
 	 */
@@ -270,9 +362,70 @@ static bool endpoint_eq(const struct endpoint *a, const struct endpoint *b)
 	       unlikely(!a->addr.sa_family && !b->addr.sa_family);
 }
 
-void wg_socket_set_peer_endpoint(struct wg_peer *peer,
-				 const struct endpoint *endpoint)
+/* Unlike endpoint_eq, this ignores the source, which changes on its own when
+ * it is cleared or local addresses move, without the peer going anywhere.
+ */
+static bool endpoint_remote_eq(const struct endpoint *a,
+			       const struct endpoint *b)
 {
+	return (a->addr.sa_family == AF_INET && b->addr.sa_family == AF_INET &&
+		a->addr4.sin_port == b->addr4.sin_port &&
+		a->addr4.sin_addr.s_addr == b->addr4.sin_addr.s_addr) ||
+	       (a->addr.sa_family == AF_INET6 &&
+		b->addr.sa_family == AF_INET6 &&
+		a->addr6.sin6_port == b->addr6.sin6_port &&
+		ipv6_addr_equal(&a->addr6.sin6_addr, &b->addr6.sin6_addr));
+}
+
+/* Must hold peer->endpoint_lock for writing. Concurrent readers may briefly
+ * see a mix of old and new, which at worst sends them down the slow path.
+ */
+static void update_endpoint_fingerprint(struct wg_peer *peer)
+{
+	struct endpoint_fingerprint *fp = &peer->endpoint_fingerprint;
+	const struct endpoint *endpoint = &peer->endpoint;
+
+	memset(fp, 0, sizeof(*fp));
+	fp->port_span = max_t(u16, endpoint->port_count, 1);
+	if (endpoint->addr.sa_family == AF_INET) {
+		fp->addr4 = endpoint->addr4.sin_addr.s_addr;
+		fp->src4 = endpoint->src4.s_addr;
+		fp->ifindex = endpoint->src_if4;
+		fp->port = endpoint->addr4.sin_port;
+		fp->family = AF_INET;
+	} else if (endpoint->addr.sa_family == AF_INET6) {
+		fp->addr6 = endpoint->addr6.sin6_addr;
+		fp->src6 = endpoint->src6;
+		fp->ifindex = endpoint->addr6.sin6_scope_id;
+		fp->port = endpoint->addr6.sin6_port;
+		fp->family = AF_INET6;
+	}
+}
+
+static bool endpoint_fingerprint_matches(const struct endpoint_fingerprint *fp,
+					 const struct sk_buff *skb)
+{
+	u16 offset = ntohs(udp_hdr(skb)->source) - ntohs(fp->port);
+
+	if (skb->protocol == htons(ETH_P_IP))
+		return fp->family == AF_INET && offset < fp->port_span &&
+		       fp->addr4 == ip_hdr(skb)->saddr &&
+		       fp->src4 == ip_hdr(skb)->daddr &&
+		       fp->ifindex == skb->skb_iif;
+	if (IS_ENABLED(CONFIG_IPV6) && skb->protocol == htons(ETH_P_IPV6))
+		return fp->family == AF_INET6 && offset < fp->port_span &&
+		       ipv6_addr_equal(&fp->addr6, &ipv6_hdr(skb)->saddr) &&
+		       ipv6_addr_equal(&fp->src6, &ipv6_hdr(skb)->daddr) &&
+		       fp->ifindex == ipv6_iface_scope_id(&ipv6_hdr(skb)->saddr,
+							  skb->skb_iif);
+	return false;
+}
+
+static void set_peer_endpoint(struct wg_peer *peer,
+			      const struct endpoint *endpoint, bool roaming)
+{
+	bool changed;
+
 	/* First we check unlocked, in order to optimize, since it's pretty rare
 	 * that an endpoint will change. If we happen to be mid-write, and two
 	 * CPUs wind up writing the same thing or something slightly different,
@@ -281,6 +434,7 @@ void wg_socket_set_peer_endpoint(struct wg_peer *peer,
 	if (endpoint_eq(endpoint, &peer->endpoint))
 		return;
 	write_lock_bh(&peer->endpoint_lock);
+	changed = !endpoint_remote_eq(endpoint, &peer->endpoint);
 	if (endpoint->addr.sa_family == AF_INET) {
 		peer->endpoint.addr4 = endpoint->addr4;
 		peer->endpoint.src4 = endpoint->src4;
@@ -289,11 +443,63 @@ void wg_socket_set_peer_endpoint(struct wg_peer *peer,
 		peer->endpoint.addr6 = endpoint->addr6;
 		peer->endpoint.src6 = endpoint->src6;
 	} else {
+		changed = false;
 		goto out;
 	}
-	dst_cache_reset(&peer->endpoint_cache);
+	if (peer->endpoint_cache)
+		dst_cache_reset(&peer->endpoint_cache->dst);
+	trace_wg_endpoint_change(peer, &peer->endpoint);
+	update_endpoint_fingerprint(peer);
+	/* Only the peer's address and port are reported, so a new source alone
+	 * is neither a roam nor a change worth telling anyone about.
+	 */
+	if (changed) {
+		if (roaming)
+			++peer->endpoint_roams;
+		wg_peer_bump_generation(peer);
+	}
 out:
 	write_unlock_bh(&peer->endpoint_lock);
+	if (changed)
+		wg_genetlink_notify_peer(peer, WGPEER_EVENT_F_ENDPOINT_CHANGED);
+}
+
+void wg_socket_set_peer_endpoint(struct wg_peer *peer,
+				 const struct endpoint *endpoint)
+{
+	set_peer_endpoint(peer, endpoint, false);
+}
+
+void wg_socket_set_peer_endpoint_port_count(struct wg_peer *peer, u16 count)
+{
+	write_lock_bh(&peer->endpoint_lock);
+	peer->endpoint.port_count = count;
+	update_endpoint_fingerprint(peer);
+	write_unlock_bh(&peer->endpoint_lock);
+}
+
+/* A peer with several listening ports may send from any of them, which should
+ * not make its endpoint move around within its own range.
+ */
+static bool endpoint_in_port_range(const struct endpoint *a,
+				   const struct endpoint *b)
+{
+	struct endpoint base = *a;
+	u16 offset;
+
+	if (b->port_count <= 1)
+		return false;
+	if (a->addr.sa_family == AF_INET && b->addr.sa_family == AF_INET) {
+		offset = ntohs(a->addr4.sin_port) - ntohs(b->addr4.sin_port);
+		base.addr4.sin_port = b->addr4.sin_port;
+	} else if (a->addr.sa_family == AF_INET6 &&
+		   b->addr.sa_family == AF_INET6) {
+		offset = ntohs(a->addr6.sin6_port) - ntohs(b->addr6.sin6_port);
+		base.addr6.sin6_port = b->addr6.sin6_port;
+	} else {
+		return false;
+	}
+	return offset < b->port_count && endpoint_eq(&base, b);
 }
 
 void wg_socket_set_peer_endpoint_from_skb(struct wg_peer *peer,
@@ -301,16 +507,120 @@ void wg_socket_set_peer_endpoint_from_skb(struct wg_peer *peer,
 {
 	struct endpoint endpoint;
 
-	if (!wg_socket_endpoint_from_skb(&endpoint, skb))
-		wg_socket_set_peer_endpoint(peer, &endpoint);
+	/* Nearly every packet comes from where the last one did, which this
+	 * checks unlocked, straight from the headers.
+	 */
+	if (likely(endpoint_fingerprint_matches(&peer->endpoint_fingerprint,
+						skb)))
+		return;
+	if (wg_socket_endpoint_from_skb(&endpoint, skb))
+		return;
+	/* Like in set_peer_endpoint, this is checked unlocked. */
+	if (unlikely(endpoint_in_port_range(&endpoint, &peer->endpoint)))
+		return;
+	/* Only a peer that already had an endpoint can be said to roam. */
+	set_peer_endpoint(peer, &endpoint,
+			  READ_ONCE(peer->endpoint.addr.sa_family) != 0);
 }
 
 void wg_socket_clear_peer_endpoint_src(struct wg_peer *peer)
 {
 	write_lock_bh(&peer->endpoint_lock);
 	memset(&peer->endpoint.src6, 0, sizeof(peer->endpoint.src6));
-	dst_cache_reset_now(&peer->endpoint_cache);
+	update_endpoint_fingerprint(peer);
+	if (peer->endpoint_cache)
+		dst_cache_reset_now(&peer->endpoint_cache->dst);
+	write_unlock_bh(&peer->endpoint_lock);
+}
+
+/* Gives the peer a route cache if it doesn't have one yet. Until it has, or if
+ * this fails, its packets are routed one list at a time without caching.
+ */
+void wg_socket_endpoint_cache_init(struct wg_peer *peer)
+{
+	struct endpoint_cache *cache;
+
+	if (likely(READ_ONCE(peer->endpoint_cache)))
+		return;
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (unlikely(!cache))
+		return;
+	cache->stats = alloc_percpu(struct endpoint_cache_stats);
+	if (unlikely(!cache->stats) ||
+	    unlikely(dst_cache_init(&cache->dst, GFP_KERNEL))) {
+		free_percpu(cache->stats);
+		kfree(cache);
+		return;
+	}
+
+	write_lock_bh(&peer->endpoint_lock);
+	if (!peer->endpoint_cache) {
+		WRITE_ONCE(peer->endpoint_cache, cache);
+		cache = NULL;
+	}
 	write_unlock_bh(&peer->endpoint_lock);
+	if (cache) {
+		dst_cache_destroy(&cache->dst);
+		free_percpu(cache->stats);
+		kfree(cache);
+	}
+}
+
+/* The hits and misses of the cache are kept in the peer's totals. */
+void wg_socket_endpoint_cache_free(struct wg_peer *peer)
+{
+	struct endpoint_cache *cache;
+	int cpu;
+
+	write_lock_bh(&peer->endpoint_lock);
+	cache = peer->endpoint_cache;
+	WRITE_ONCE(peer->endpoint_cache, NULL);
+	if (cache) {
+		for_each_possible_cpu(cpu) {
+			const struct endpoint_cache_stats *stats =
+				per_cpu_ptr(cache->stats, cpu);
+
+			peer->endpoint_cache_hits += stats->hits;
+			peer->endpoint_cache_misses += stats->misses;
+		}
+	}
+	write_unlock_bh(&peer->endpoint_lock);
+	if (!cache)
+		return;
+	dst_cache_destroy(&cache->dst);
+	free_percpu(cache->stats);
+	kfree(cache);
+}
+
+void wg_socket_route_prewarm_worker(struct work_struct *work)
+{
+	struct wg_peer *peer = container_of(work, struct wg_peer,
+					    route_prewarm_work);
+
+	wg_socket_send_skbs_to_peer(peer, NULL);
+	wg_peer_put(peer);
+}
+
+/* Refreshes the cached route of a peer that is sending data after the routing
+ * tables change, rather than leaving it to the next packet. Peers that haven't
+ * sent anything within a keepalive timeout just look the route up when they
+ * next do. Since the cache is per CPU, this is done on the CPU that transmits
+ * for the peer. This is called under RCU, so a peer removed concurrently is
+ * skipped here, before its removal flushes the workqueue.
+ */
+void wg_socket_prewarm_peer_route(struct wg_peer *peer)
+{
+	if (READ_ONCE(peer->is_dead) ||
+	    !rcu_access_pointer(peer->keypairs.current_keypair) ||
+	    time_after_eq(jiffies, READ_ONCE(peer->last_data_sent) +
+				   peer->device->keepalive_timeout * HZ))
+		return;
+	wg_peer_get(peer);
+	if (!queue_work_on(wg_cpumask_choose_online(&peer->serial_work_cpu,
+						    peer->internal_id),
+			   peer->device->packet_crypt_wq,
+			   &peer->route_prewarm_work))
+		wg_peer_put(peer);
 }
 
 static int wg_receive(struct sock *sk, struct sk_buff *skb)
@@ -346,16 +656,19 @@ static void set_sock_opts(struct socket *sock)
 	sk_set_memalloc(sock->sk);
 }
 
-int wg_socket_init(struct wg_device *wg, u16 port)
+/* When may_retry is set, the caller picks another port on -EADDRINUSE, so that
+ * isn't worth an error message.
+ */
+static int create_sockets(struct net *net, struct wg_device *wg, u16 port,
+			  bool may_retry, struct sock **new4, struct sock **new6)
 {
-	struct net *net;
 	int ret;
 	struct udp_tunnel_sock_cfg cfg = {
 		.sk_user_data = wg,
 		.encap_type = 1,
 		.encap_rcv = wg_receive
 	};
-	struct socket *new4 = NULL, *new6 = NULL;
+	struct socket *sock4 = NULL, *sock6 = NULL;
 	struct udp_port_cfg port4 = {
 		.family = AF_INET,
 		.local_ip.s_addr = htonl(INADDR_ANY),
@@ -363,7 +676,6 @@ int wg_socket_init(struct wg_device *wg, u16 port)
 		.use_udp_checksums = true
 	};
 #if IS_ENABLED(CONFIG_IPV6)
-	int retries = 0;
 	struct udp_port_cfg port6 = {
 		.family = AF_INET6,
 		.local_ip6 = IN6ADDR_ANY_INIT,
@@ -373,6 +685,48 @@ int wg_socket_init(struct wg_device *wg, u16 port)
 	};
 #endif
 
+	ret = udp_sock_create(net, &port4, &sock4);
+	if (ret < 0) {
+		if (ret != -EADDRINUSE || !may_retry)
+			pr_err("%s: Could not create IPv4 socket\n",
+			       wg->dev->name);
+		return ret;
+	}
+	set_sock_opts(sock4);
+	setup_udp_tunnel_sock(net, sock4, &cfg);
+
+#if IS_ENABLED(CONFIG_IPV6)
+	if (ipv6_mod_enabled()) {
+		port6.local_udp_port = inet_sk(sock4->sk)->inet_sport;
+		ret = udp_sock_create(net, &port6, &sock6);
+		if (ret < 0) {
+			udp_tunnel_sock_release(sock4);
+			if (ret != -EADDRINUSE || !may_retry)
+				pr_err("%s: Could not create IPv6 socket\n",
+				       wg->dev->name);
+			return ret;
+		}
+		set_sock_opts(sock6);
+		setup_udp_tunnel_sock(net, sock6, &cfg);
+	}
+#endif
+
+	*new4 = sock4->sk;
+	*new6 = sock6 ? sock6->sk : NULL;
+	return 0;
+}
+
+/* Binds a range of count consecutive ports starting at port, or at a random
+ * port if it is zero. The sockets in use are only replaced once all are bound.
+ */
+int wg_socket_init(struct wg_device *wg, u16 port, u16 count)
+{
+	struct sock *new4[MAX_SOCKETS_PER_DEVICE], *new6[MAX_SOCKETS_PER_DEVICE];
+	unsigned int i;
+	int retries = 0, ret;
+	struct net *net;
+	u16 base;
+
 	rcu_read_lock();
 	net = rcu_dereference(wg->creating_net);
 	net = net ? maybe_get_net(net) : NULL;
@@ -380,58 +734,56 @@ int wg_socket_init(struct wg_device *wg, u16 port)
 	if (unlikely(!net))
 		return -ENONET;
 
-#if IS_ENABLED(CONFIG_IPV6)
 retry:
-#endif
-
-	ret = udp_sock_create(net, &port4, &new4);
-	if (ret < 0) {
-		pr_err("%s: Could not create IPv4 socket\n", wg->dev->name);
-		goto out;
-	}
-	set_sock_opts(new4);
-	setup_udp_tunnel_sock(net, new4, &cfg);
-
-#if IS_ENABLED(CONFIG_IPV6)
-	if (ipv6_mod_enabled()) {
-		port6.local_udp_port = inet_sk(new4->sk)->inet_sport;
-		ret = udp_sock_create(net, &port6, &new6);
+	base = port;
+	for (i = 0; i < count; ++i) {
+		if (i && (u32)base + i > U16_MAX)
+			ret = -EADDRINUSE;
+		else
+			ret = create_sockets(net, wg, i ? base + i : port,
+					     !port, &new4[i], &new6[i]);
 		if (ret < 0) {
-			udp_tunnel_sock_release(new4);
+			while (i--) {
+				sock_free(new4[i]);
+				sock_free(new6[i]);
+			}
 			if (ret == -EADDRINUSE && !port && retries++ < 100)
 				goto retry;
-			pr_err("%s: Could not create IPv6 socket\n",
-			       wg->dev->name);
 			goto out;
 		}
-		set_sock_opts(new6);
-		setup_udp_tunnel_sock(net, new6, &cfg);
+		if (!i)
+			base = ntohs(inet_sk(new4[0])->inet_sport);
 	}
-#endif
 
-	wg_socket_reinit(wg, new4->sk, new6 ? new6->sk : NULL);
+	wg_socket_reinit(wg, new4, new6, count);
 	ret = 0;
 out:
 	put_net(net);
 	return ret;
 }
 
-void wg_socket_reinit(struct wg_device *wg, struct sock *new4,
-		      struct sock *new6)
+void wg_socket_reinit(struct wg_device *wg, struct sock *new4[],
+		      struct sock *new6[], unsigned int count)
 {
-	struct sock *old4, *old6;
+	struct sock *old4[MAX_SOCKETS_PER_DEVICE], *old6[MAX_SOCKETS_PER_DEVICE];
+	unsigned int i;
 
 	mutex_lock(&wg->socket_update_lock);
-	old4 = rcu_dereference_protected(wg->sock4,
+	for (i = 0; i < MAX_SOCKETS_PER_DEVICE; ++i) {
+		old4[i] = rcu_dereference_protected(wg->sock4[i],
 				lockdep_is_held(&wg->socket_update_lock));
-	old6 = rcu_dereference_protected(wg->sock6,
+		old6[i] = rcu_dereference_protected(wg->sock6[i],
 				lockdep_is_held(&wg->socket_update_lock));
-	rcu_assign_pointer(wg->sock4, new4);
-	rcu_assign_pointer(wg->sock6, new6);
-	if (new4)
-		wg->incoming_port = ntohs(inet_sk(new4)->inet_sport);
+		rcu_assign_pointer(wg->sock4[i], i < count ? new4[i] : NULL);
+		rcu_assign_pointer(wg->sock6[i], i < count ? new6[i] : NULL);
+	}
+	WRITE_ONCE(wg->sock_count, count);
+	if (count)
+		wg->incoming_port = ntohs(inet_sk(new4[0])->inet_sport);
 	mutex_unlock(&wg->socket_update_lock);
 	synchronize_net();
-	sock_free(old4);
-	sock_free(old6);
+	for (i = 0; i < MAX_SOCKETS_PER_DEVICE; ++i) {
+		sock_free(old4[i]);
+		sock_free(old6[i]);
+	}
 }
@@ -11,13 +11,12 @@
 #include <linux/if_vlan.h>
 #include <linux/if_ether.h>
 
-int wg_socket_init(struct wg_device *wg, u16 port);
-void wg_socket_reinit(struct wg_device *wg, struct sock *new4,
-		      struct sock *new6);
+int wg_socket_init(struct wg_device *wg, u16 port, u16 count);
+void wg_socket_reinit(struct wg_device *wg, struct sock *new4[],
+		      struct sock *new6[], unsigned int count);
 int wg_socket_send_buffer_to_peer(struct wg_peer *peer, void *data,
 				  size_t len, u8 ds);
-int wg_socket_send_skb_to_peer(struct wg_peer *peer, struct sk_buff *skb,
-			       u8 ds);
+int wg_socket_send_skbs_to_peer(struct wg_peer *peer, struct sk_buff *first);
 int wg_socket_send_buffer_as_reply_to_skb(struct wg_device *wg,
 					  struct sk_buff *in_skb,
 					  void *out_buffer, size_t len);
@@ -28,7 +27,12 @@ void wg_socket_set_peer_endpoint(struct wg_peer *peer,
 				 const struct endpoint *endpoint);
 void wg_socket_set_peer_endpoint_from_skb(struct wg_peer *peer,
 					  const struct sk_buff *skb);
+void wg_socket_set_peer_endpoint_port_count(struct wg_peer *peer, u16 count);
 void wg_socket_clear_peer_endpoint_src(struct wg_peer *peer);
+void wg_socket_endpoint_cache_init(struct wg_peer *peer);
+void wg_socket_endpoint_cache_free(struct wg_peer *peer);
+void wg_socket_prewarm_peer_route(struct wg_peer *peer);
+void wg_socket_route_prewarm_worker(struct work_struct *work);
 
 #if defined(CONFIG_DYNAMIC_DEBUG) || defined(DEBUG)
 #define net_dbg_skb_ratelimited(fmt, dev, skb, ...) do {                       \
@@ -0,0 +1,251 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Copyright (C) 2015-2019 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+#
+# This script runs benchmarks against the wireguard module inside of scratch
+# network namespaces, printing progress to stderr and CSV results to stdout, so
+# that it may be redirected straight into a file. Usage:
+#
+#     ./benchmark.sh [config|throughput|handshake]...
+#
+# With no arguments, all benchmarks are run. The benchmarks are:
+#
+#   config:     time taken to load a configuration of increasing numbers of
+#               peers with `wg setconf`, and then to change the private key,
+#               which forces the recomputation of every peer's static-static
+#               key. The peer counts may be overridden with PEERS="1000 10000".
+#
+#   throughput: iperf3 between wg0 in $ns1 and wg0 in $ns2, whose sockets both
+#               live on the loopback of $ns0, as in netns.sh. Every combination
+#               of PROTOCOLS (tcp udp), SIZES (64 512 1400 65536), FLOWS (1 4)
+#               and TUNNEL_PEERS (1 1000) is run for DURATION (10) seconds,
+#               after a second of warm up. The size is the payload length of
+#               each UDP datagram, or the MSS of TCP, where 65536 leaves the MSS
+#               alone so that GSO builds 64K super-packets; UDP sizes that don't
+#               fit into the tunnel's MTU are skipped. Peers beyond the first
+#               are given random keys and allowed IPs, and never see traffic.
+#               The iperf3 client and server are pinned to CLIENT_CPU (0) and
+#               SERVER_CPU (1). Rates are taken from the receiving wg0's
+#               counters, and cycles per packet from the CPU time used by the
+#               whole system, at CPU_MHZ, which defaults to the first CPU's
+#               current frequency. For numbers comparable between runs, pin the
+#               CPU frequency and keep the machine otherwise idle.
+#
+#   handshake:  HANDSHAKES (1000 10000 100000) new peers reconnecting to wg0 in
+#               $ns1 at once, each sending an initiation from its own address,
+#               at each of RATES (0 10000) initiations per second, where 0 is
+#               as fast as they can be injected. This is driven by the packet
+#               generator in debugfs, so it needs a debug build with debugfs
+#               mounted, and is skipped otherwise. It reports the initiations
+#               accepted and the rate they were accepted at, the cookie replies
+#               sent because of load, handshake drops by reason, and the time
+#               from each initiation to its session, in microseconds.
+set -e
+shopt -s extglob
+
+exec 3>&2
+export LANG=C
+NPROC=( /sys/devices/system/cpu/cpu+([0-9]) ); NPROC=${#NPROC[@]}
+netns0="wg-bench-$$-0"
+netns1="wg-bench-$$-1"
+netns2="wg-bench-$$-2"
+pretty() { echo -e "\x1b[32m\x1b[1m[+] ${1:+NS$1: }${2}\x1b[0m" >&3; }
+pp() { pretty "" "$*"; "$@"; }
+maybe_exec() { if [[ $BASHPID -eq $$ ]]; then "$@"; else exec "$@"; fi; }
+n0() { pretty 0 "$*"; maybe_exec ip netns exec $netns0 "$@"; }
+n1() { pretty 1 "$*"; maybe_exec ip netns exec $netns1 "$@"; }
+n2() { pretty 2 "$*"; maybe_exec ip netns exec $netns2 "$@"; }
+ip0() { pretty 0 "ip $*"; ip -n $netns0 "$@"; }
+ip1() { pretty 1 "ip $*"; ip -n $netns1 "$@"; }
+ip2() { pretty 2 "ip $*"; ip -n $netns2 "$@"; }
+waitiperf() { pretty "${1//*-}" "wait for iperf:5201 pid $2"; while [[ $(ss -N "$1" -tlpH 'sport = 5201') != *\"iperf3\",pid=$2,fd=* ]]; do sleep 0.1; done; }
+now_us() { local t; t="$(date +%s%N)"; echo $(( t / 1000 )); }
+
+cleanup() {
+	set +e
+	exec 2>/dev/null
+	ip0 link del dev wg0
+	ip1 link del dev wg0
+	ip2 link del dev wg0
+	local to_kill="$(ip netns pids $netns0) $(ip netns pids $netns1) $(ip netns pids $netns2)"
+	[[ -n ${to_kill// } ]] && kill $to_kill
+	pp ip netns del $netns1
+	pp ip netns del $netns2
+	pp ip netns del $netns0
+	rm -f "$scratch"
+	exit
+}
+
+trap cleanup EXIT
+scratch="$(mktemp)"
+ip netns del $netns0 2>/dev/null || true
+ip netns del $netns1 2>/dev/null || true
+ip netns del $netns2 2>/dev/null || true
+pp ip netns add $netns0
+pp ip netns add $netns1
+pp ip netns add $netns2
+ip0 link set up dev lo
+
+# Generating real keys with `wg genkey | wg pubkey` is far too slow for large
+# numbers of peers, so we use random public keys instead, which are just as
+# costly for the kernel. 30 random bytes are 40 base64 characters without
+# padding, and the remaining two zero bytes are "AAA=".
+random_pubkeys() {
+	head -c $(( 30 * $1 )) /dev/urandom | base64 -w 40 | sed 's/$/AAA=/'
+}
+
+bench_config() {
+	local peers start setconf rekey
+
+	echo "peers,cpus,setconf_us,rekey_us"
+	for peers in ${PEERS:-1 100 1000 10000 50000}; do
+		{
+			echo "[Interface]"
+			echo "PrivateKey=$(wg genkey)"
+			random_pubkeys $peers | sed 's/^/[Peer]\nPublicKey=/'
+		} > "$scratch"
+		ip0 link add dev wg0 type wireguard
+		start=$(now_us)
+		n0 wg setconf wg0 "$scratch"
+		setconf=$(( $(now_us) - start ))
+		[[ $(n0 wg show wg0 peers | wc -l) -eq $peers ]]
+		start=$(now_us)
+		n0 wg set wg0 private-key <(wg genkey)
+		rekey=$(( $(now_us) - start ))
+		ip0 link del dev wg0
+		echo "$peers,$NPROC,$setconf,$rekey"
+	done
+}
+
+# Prints the interface's config for talking to the other side, followed by
+# $4 - 1 peers that nothing is routed to, with allowed IPs out of 10.0.0.0/8.
+throughput_conf() {
+	echo "[Interface]"
+	echo "PrivateKey=$1"
+	echo "ListenPort=$2"
+	echo "[Peer]"
+	echo "PublicKey=$3"
+	echo "AllowedIPs=192.168.241.$(( 3 - $2 ))/32"
+	echo "Endpoint=127.0.0.1:$(( 3 - $2 ))"
+	random_pubkeys $(( $4 - 1 )) | awk '{
+		i = NR
+		printf "[Peer]\nPublicKey=%s\nAllowedIPs=10.%d.%d.%d/32\n", $0,
+		       int(i / 65536) % 256, int(i / 256) % 256, i % 256
+	}'
+}
+
+# Prints the busy jiffies of all CPUs together.
+cpu_busy() {
+	local _ user nice system idle iowait irq softirq
+	read _ user nice system idle iowait irq softirq _ < /proc/stat
+	echo $(( user + nice + system + irq + softirq ))
+}
+
+read_counter() {
+	ip netns exec $1 cat /sys/class/net/wg0/statistics/$2
+}
+
+bench_throughput() {
+	local key1 key2 pub1 pub2 peers proto size flows mtu client_args
+	local pid client packets bytes busy hz mhz
+
+	hz=$(getconf CLK_TCK)
+	mhz=${CPU_MHZ:-$(awk -F': *' '/^cpu MHz/ { print $2; exit }' /proc/cpuinfo)}
+	key1="$(pp wg genkey)"
+	key2="$(pp wg genkey)"
+	pub1="$(pp wg pubkey <<<"$key1")"
+	pub2="$(pp wg pubkey <<<"$key2")"
+	ip0 link add dev wg0 type wireguard
+	ip0 link set wg0 netns $netns1
+	ip0 link add dev wg0 type wireguard
+	ip0 link set wg0 netns $netns2
+	ip1 addr add 192.168.241.1/24 dev wg0
+	ip2 addr add 192.168.241.2/24 dev wg0
+	ip1 link set up dev wg0
+	ip2 link set up dev wg0
+	[[ $(ip1 link show dev wg0) =~ mtu\ ([0-9]+) ]] && mtu="${BASH_REMATCH[1]}"
+
+	echo "protocol,size,flows,peers,cpus,seconds,pps,gbps,cycles_per_packet"
+	for peers in ${TUNNEL_PEERS:-1 1000}; do
+		throughput_conf "$key1" 1 "$pub2" $peers > "$scratch"
+		n1 wg setconf wg0 "$scratch"
+		throughput_conf "$key2" 2 "$pub1" $peers > "$scratch"
+		n2 wg setconf wg0 "$scratch"
+		for proto in ${PROTOCOLS:-tcp udp}; do
+		for size in ${SIZES:-64 512 1400 65536}; do
+		for flows in ${FLOWS:-1 4}; do
+			if [[ $proto == udp ]]; then
+				(( size <= mtu - 28 )) || continue
+				client_args=( -u -b 0 -l $size )
+			elif (( size < 65536 )); then
+				client_args=( -M $size )
+			else
+				client_args=( )
+			fi
+			n2 taskset -c ${SERVER_CPU:-1} iperf3 -s -1 -B 192.168.241.2 >/dev/null &
+			pid=$!
+			waitiperf $netns2 $pid
+			n1 taskset -c ${CLIENT_CPU:-0} iperf3 -c 192.168.241.2 -t $(( ${DURATION:-10} + 2 )) -P $flows "${client_args[@]}" >/dev/null &
+			client=$!
+			sleep 1
+			packets=$(read_counter $netns2 rx_packets)
+			bytes=$(read_counter $netns2 rx_bytes)
+			busy=$(cpu_busy)
+			sleep ${DURATION:-10}
+			packets=$(( $(read_counter $netns2 rx_packets) - packets ))
+			bytes=$(( $(read_counter $netns2 rx_bytes) - bytes ))
+			busy=$(( $(cpu_busy) - busy ))
+			wait $client $pid
+			awk -v proto=$proto -v size=$size -v flows=$flows -v peers=$peers \
+			    -v cpus=$NPROC -v seconds=${DURATION:-10} -v packets=$packets \
+			    -v bytes=$bytes -v busy=$busy -v hz=$hz -v mhz="$mhz" 'BEGIN {
+				cycles = (mhz != "" && packets) ? sprintf("%.0f", busy / hz * mhz * 1000000 / packets) : ""
+				printf "%s,%d,%d,%d,%d,%d,%.0f,%.3f,%s\n", proto, size, flows,
+				       peers, cpus, seconds, packets / seconds,
+				       bytes * 8 / seconds / 1000000000, cycles
+			}'
+		done
+		done
+		done
+	done
+	ip1 link del dev wg0
+	ip2 link del dev wg0
+}
+
+bench_handshake() {
+	local pktgen=/sys/kernel/debug/wireguard/pktgen count rate result fields
+
+	if [[ ! -w $pktgen ]]; then
+		pretty "" "Skipping, as $pktgen is missing"
+		return
+	fi
+	fields='in ([0-9]+) ns, ([0-9]+) accepted, ([0-9]+) accepted/s, ([0-9]+) cookie replies, drops: ([0-9]+) queue full, ([0-9]+) ratelimited, ([0-9]+) invalid mac, ([0-9]+) invalid, latency to session: ([0-9]+) us average, ([0-9]+) us max'
+	ip0 link add dev wg0 type wireguard
+	ip0 link set wg0 netns $netns1
+	n1 wg set wg0 private-key <(wg genkey) listen-port 1
+	ip1 link set up dev wg0
+
+	echo "initiations,rate,cpus,seconds,accepted,accepted_per_second,cookie_replies,queue_full,ratelimited,invalid_mac,invalid,latency_avg_us,latency_max_us"
+	for count in ${HANDSHAKES:-1000 10000 100000}; do
+		for rate in ${RATES:-0 10000}; do
+			# The file is opened out here, since `ip netns exec` remounts
+			# /sys, but written from within $ns1, whose wg0 it looks up.
+			n1 bash -c "echo handshake wg0 $count $rate >&4" 4>"$pktgen"
+			result="$(< "$pktgen")"
+			[[ $result =~ $fields ]]
+			awk -v count=$count -v rate=$rate -v cpus=$NPROC -v ns=${BASH_REMATCH[1]} 'BEGIN {
+				printf "%d,%d,%d,%.3f,", count, rate, cpus, ns / 1000000000
+			}'
+			( IFS=,; echo "${BASH_REMATCH[*]:2}" )
+		done
+	done
+	ip1 link del dev wg0
+}
+
+benchmarks=( "$@" )
+[[ ${#benchmarks[@]} -ne 0 ]] || benchmarks=( config throughput handshake )
+for benchmark in "${benchmarks[@]}"; do
+	pretty "" "Running $benchmark benchmark"
+	"bench_$benchmark"
+done
@@ -23,6 +23,9 @@ insert: debug
 test: insert
 	sudo PATH="$$PATH:/usr/sbin:/sbin:/usr/bin:/bin:/usr/local/sbin:/usr/local/bin" ./tests/netns.sh
 
+benchmark: insert
+	sudo PATH="$$PATH:/usr/sbin:/sbin:/usr/bin:/bin:/usr/local/sbin:/usr/local/bin" ./tests/benchmark.sh $(BENCHMARKS)
+
 test-qemu:
 	$(MAKE) -C tests/qemu
 
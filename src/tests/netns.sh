@@ -254,6 +254,25 @@ n2 wg set wg0 peer "$pub3" preshared-key <(echo "$psk") allowed-ips 192.168.241.
 n1 ping -W 1 -c 1 192.168.241.2
 n2 wg set wg0 peer "$pub3" remove
 
+# Test that a storm of initiations from many new peers is answered, and that
+# the interface hands out cookies under load, which a single CPU might be too
+# busy injecting to notice. The debugfs file is opened out
+# here, since `ip netns exec` remounts /sys, but written from within $ns2,
+# whose interfaces it looks up.
+if [[ -w /sys/kernel/debug/wireguard/pktgen ]]; then
+	peers_before=$(n2 wg show wg0 peers | wc -l)
+	n2 bash -c 'echo handshake wg0 200 1000 >&4' 4>/sys/kernel/debug/wireguard/pktgen
+	read -r storm < /sys/kernel/debug/wireguard/pktgen
+	pretty 2 "$storm"
+	[[ $storm == *" 200 accepted,"*" 0 cookie replies,"* ]]
+	n2 bash -c 'echo handshake wg0 2000 >&4' 4>/sys/kernel/debug/wireguard/pktgen
+	read -r storm < /sys/kernel/debug/wireguard/pktgen
+	pretty 2 "$storm"
+	[[ $storm =~ \ ([0-9]+)\ cookie\ replies ]]
+	(( NPROC == 1 || BASH_REMATCH[1] > 0 ))
+	[[ $(n2 wg show wg0 peers | wc -l) -eq $peers_before ]]
+fi
+
 # Test that we can route wg through wg
 ip1 addr flush dev wg0
 ip2 addr flush dev wg0
@@ -8,16 +8,18 @@
 #include "peer.h"
 #include "queueing.h"
 #include "socket.h"
+#include "netlink.h"
 
 /*
  * - Timer for retransmitting the handshake if we don't hear back after
  * `REKEY_TIMEOUT + jitter` ms.
  *
  * - Timer for sending empty packet if we have received a packet but after have
- * not sent one for `KEEPALIVE_TIMEOUT` ms.
+ * not sent one for the device's `keepalive_timeout` ms, which defaults to
+ * `KEEPALIVE_TIMEOUT`.
  *
  * - Timer for initiating new handshake if we have sent a packet but after have
- * not received one (even empty) for `(KEEPALIVE_TIMEOUT + REKEY_TIMEOUT) +
+ * not received one (even empty) for `(keepalive_timeout + REKEY_TIMEOUT) +
  * jitter` ms.
  *
  * - Timer for zeroing out all ephemeral keys after `(REJECT_AFTER_TIME * 3)` ms
@@ -25,30 +27,78 @@
  *
  * - Timer for, if enabled, sending an empty authenticated packet every user-
  * specified seconds.
+ *
+ * - Timer for sending coalesced events to userspace, no more often than every
+ * `PEER_EVENTS_INTERVAL` jiffies.
+ *
+ * - Timer for sending staged packets and persistent keepalives after the
+ * interface comes up, staggered across the device's `bring_up_spread` ms.
  */
 
-static inline void mod_peer_timer(struct wg_peer *peer,
-				  struct timer_list *timer,
+/*
+ * Rather than giving each of these its own timer_list, each peer has a single
+ * timer, armed for the earliest of the deadlines above. Setting a deadline
+ * that is no earlier than the armed one is then just a store, and so is
+ * cancelling one, by storing zero, which matters because the functions below
+ * are called for every packet. When the timer fires for a deadline that has
+ * since been pushed back or cancelled, it simply rearms for whatever is next.
+ */
+
+enum { PEER_EVENTS_INTERVAL = HZ / 10 };
+
+static inline bool peer_timer_pending(struct wg_peer *peer, enum wg_timer timer)
+{
+	return READ_ONCE(peer->timer_deadlines[timer]) != 0;
+}
+
+static inline void reduce_peer_timer(struct wg_peer *peer, unsigned long expires)
+{
+#ifndef COMPAT_CANNOT_USE_TIMER_REDUCE
+	/* A racy read of expires is fine, since timer_reduce checks again. */
+	if (!timer_pending(&peer->timer) ||
+	    time_before(expires, READ_ONCE(peer->timer.expires)))
+		timer_reduce(&peer->timer, expires);
+#else
+	/* Without timer_reduce, the check and the change need a lock, lest a
+	 * later expiry replace an earlier one.
+	 */
+	spin_lock_bh(&peer->timer_lock);
+	if (!timer_pending(&peer->timer) ||
+	    time_before(expires, peer->timer.expires))
+		mod_timer(&peer->timer, expires);
+	spin_unlock_bh(&peer->timer_lock);
+#endif
+}
+
+static inline void set_peer_timer(struct wg_peer *peer, enum wg_timer timer,
 				  unsigned long expires)
 {
+	/* Zero means that there is no deadline, so this becomes a jiffy late. */
+	if (unlikely(!expires))
+		expires = 1;
 	rcu_read_lock_bh();
 	if (likely(netif_running(peer->device->dev) &&
-		   !READ_ONCE(peer->is_dead)))
-		mod_timer(timer, expires);
+		   !READ_ONCE(peer->is_dead))) {
+		WRITE_ONCE(peer->timer_deadlines[timer], expires);
+		reduce_peer_timer(peer, expires);
+	}
 	rcu_read_unlock_bh();
 }
 
-static void wg_expired_retransmit_handshake(struct timer_list *timer)
+static inline void del_peer_timer(struct wg_peer *peer, enum wg_timer timer)
 {
-	struct wg_peer *peer = from_timer(peer, timer,
-					  timer_retransmit_handshake);
+	if (peer_timer_pending(peer, timer))
+		WRITE_ONCE(peer->timer_deadlines[timer], 0);
+}
 
+static void wg_expired_retransmit_handshake(struct wg_peer *peer)
+{
 	if (peer->timer_handshake_attempts > MAX_TIMER_HANDSHAKES) {
 		pr_debug("%s: Handshake for peer %llu (%pISpfsc) did not complete after %d attempts, giving up\n",
 			 peer->device->dev->name, peer->internal_id,
 			 &peer->endpoint.addr, MAX_TIMER_HANDSHAKES + 2);
 
-		del_timer(&peer->timer_send_keepalive);
+		del_peer_timer(peer, WG_TIMER_SEND_KEEPALIVE);
 		/* We drop all packets without a keypair and don't try again,
 		 * if we try unsuccessfully for too long to make a handshake.
 		 */
@@ -57,9 +107,11 @@ static void wg_expired_retransmit_handshake(struct timer_list *timer)
 		/* We set a timer for destroying any residue that might be left
 		 * of a partial exchange.
 		 */
-		if (!timer_pending(&peer->timer_zero_key_material))
-			mod_peer_timer(peer, &peer->timer_zero_key_material,
+		if (!peer_timer_pending(peer, WG_TIMER_ZERO_KEY_MATERIAL))
+			set_peer_timer(peer, WG_TIMER_ZERO_KEY_MATERIAL,
 				       jiffies + REJECT_AFTER_TIME * 3 * HZ);
+
+		wg_genetlink_notify_peer(peer, WGPEER_EVENT_F_HANDSHAKE_GAVE_UP);
 	} else {
 		++peer->timer_handshake_attempts;
 		pr_debug("%s: Handshake for peer %llu (%pISpfsc) did not complete after %d seconds, retrying (try %d)\n",
@@ -76,25 +128,22 @@ static void wg_expired_retransmit_handshake(struct timer_list *timer)
 	}
 }
 
-static void wg_expired_send_keepalive(struct timer_list *timer)
+static void wg_expired_send_keepalive(struct wg_peer *peer)
 {
-	struct wg_peer *peer = from_timer(peer, timer, timer_send_keepalive);
-
 	wg_packet_send_keepalive(peer);
 	if (peer->timer_need_another_keepalive) {
 		peer->timer_need_another_keepalive = false;
-		mod_peer_timer(peer, &peer->timer_send_keepalive,
-			       jiffies + KEEPALIVE_TIMEOUT * HZ);
+		set_peer_timer(peer, WG_TIMER_SEND_KEEPALIVE,
+			       jiffies + peer->device->keepalive_timeout * HZ);
 	}
 }
 
-static void wg_expired_new_handshake(struct timer_list *timer)
+static void wg_expired_new_handshake(struct wg_peer *peer)
 {
-	struct wg_peer *peer = from_timer(peer, timer, timer_new_handshake);
-
 	pr_debug("%s: Retrying handshake with peer %llu (%pISpfsc) because we stopped hearing back after %d seconds\n",
 		 peer->device->dev->name, peer->internal_id,
-		 &peer->endpoint.addr, KEEPALIVE_TIMEOUT + REKEY_TIMEOUT);
+		 &peer->endpoint.addr,
+		 peer->device->keepalive_timeout + REKEY_TIMEOUT);
 	/* We clear the endpoint address src address, in case this is the cause
 	 * of trouble.
 	 */
@@ -102,10 +151,8 @@ static void wg_expired_new_handshake(struct timer_list *timer)
 	wg_packet_send_queued_handshake_initiation(peer, false);
 }
 
-static void wg_expired_zero_key_material(struct timer_list *timer)
+static void wg_expired_zero_key_material(struct wg_peer *peer)
 {
-	struct wg_peer *peer = from_timer(peer, timer, timer_zero_key_material);
-
 	rcu_read_lock_bh();
 	if (!READ_ONCE(peer->is_dead)) {
 		wg_peer_get(peer);
@@ -129,24 +176,84 @@ static void wg_queued_expired_zero_key_material(struct work_struct *work)
 		 &peer->endpoint.addr, REJECT_AFTER_TIME * 3);
 	wg_noise_handshake_clear(&peer->handshake);
 	wg_noise_keypairs_clear(&peer->keypairs);
+	wg_socket_endpoint_cache_free(peer);
 	wg_peer_put(peer);
 }
 
-static void wg_expired_send_persistent_keepalive(struct timer_list *timer)
+static void wg_expired_send_persistent_keepalive(struct wg_peer *peer)
 {
-	struct wg_peer *peer = from_timer(peer, timer,
-					  timer_persistent_keepalive);
-
 	if (likely(peer->persistent_keepalive_interval))
 		wg_packet_send_keepalive(peer);
 }
 
+static void wg_expired_send_events(struct wg_peer *peer)
+{
+	peer->last_events_sent = jiffies;
+	wg_genetlink_send_peer_events(peer);
+}
+
+static void wg_expired_bring_up(struct wg_peer *peer)
+{
+	wg_packet_send_staged_packets(peer);
+	if (peer->persistent_keepalive_interval)
+		wg_packet_send_keepalive(peer);
+}
+
+static void (*const expired_handlers[__WG_TIMER_COUNT])(struct wg_peer *) = {
+	[WG_TIMER_RETRANSMIT_HANDSHAKE] = wg_expired_retransmit_handshake,
+	[WG_TIMER_SEND_KEEPALIVE] = wg_expired_send_keepalive,
+	[WG_TIMER_NEW_HANDSHAKE] = wg_expired_new_handshake,
+	[WG_TIMER_ZERO_KEY_MATERIAL] = wg_expired_zero_key_material,
+	[WG_TIMER_PERSISTENT_KEEPALIVE] = wg_expired_send_persistent_keepalive,
+	[WG_TIMER_SEND_EVENTS] = wg_expired_send_events,
+	[WG_TIMER_BRING_UP] = wg_expired_bring_up
+};
+
+static void wg_expired_peer_timer(struct timer_list *timer)
+{
+	struct wg_peer *peer = from_timer(peer, timer, timer);
+	unsigned long now = jiffies, next = now + MAX_JIFFY_OFFSET;
+	unsigned long deadline;
+	bool rearm = false;
+	int i;
+
+	for (i = 0; i < __WG_TIMER_COUNT; ++i) {
+		deadline = READ_ONCE(peer->timer_deadlines[i]);
+		if (!deadline)
+			continue;
+		if (time_after(deadline, now)) {
+			if (time_before(deadline, next))
+				next = deadline;
+			rearm = true;
+			continue;
+		}
+		/* The deadline is only taken if it wasn't concurrently
+		 * cancelled, which must win, or replaced, in which case the
+		 * replacement has armed the timer for itself.
+		 */
+		if (cmpxchg(&peer->timer_deadlines[i], deadline, 0) == deadline)
+			expired_handlers[i](peer);
+	}
+	/* Handlers that set deadlines of their own arm the timer themselves. */
+	if (rearm) {
+		rcu_read_lock_bh();
+		if (likely(netif_running(peer->device->dev) &&
+			   !READ_ONCE(peer->is_dead)))
+			reduce_peer_timer(peer, next);
+		rcu_read_unlock_bh();
+	}
+}
+
 /* Should be called after an authenticated data packet is sent. */
 void wg_timers_data_sent(struct wg_peer *peer)
 {
-	if (!timer_pending(&peer->timer_new_handshake))
-		mod_peer_timer(peer, &peer->timer_new_handshake,
-			jiffies + (KEEPALIVE_TIMEOUT + REKEY_TIMEOUT) * HZ +
+	/* Only written once per jiffy, for route prewarming. */
+	if (READ_ONCE(peer->last_data_sent) != jiffies)
+		WRITE_ONCE(peer->last_data_sent, jiffies);
+	if (!peer_timer_pending(peer, WG_TIMER_NEW_HANDSHAKE))
+		set_peer_timer(peer, WG_TIMER_NEW_HANDSHAKE,
+			jiffies + (peer->device->keepalive_timeout +
+				   REKEY_TIMEOUT) * HZ +
 			prandom_u32_max(REKEY_TIMEOUT_JITTER_MAX_JIFFIES));
 }
 
@@ -154,9 +261,9 @@ void wg_timers_data_sent(struct wg_peer *peer)
 void wg_timers_data_received(struct wg_peer *peer)
 {
 	if (likely(netif_running(peer->device->dev))) {
-		if (!timer_pending(&peer->timer_send_keepalive))
-			mod_peer_timer(peer, &peer->timer_send_keepalive,
-				       jiffies + KEEPALIVE_TIMEOUT * HZ);
+		if (!peer_timer_pending(peer, WG_TIMER_SEND_KEEPALIVE))
+			set_peer_timer(peer, WG_TIMER_SEND_KEEPALIVE,
+				jiffies + peer->device->keepalive_timeout * HZ);
 		else
 			peer->timer_need_another_keepalive = true;
 	}
@@ -167,7 +274,7 @@ void wg_timers_data_received(struct wg_peer *peer)
  */
 void wg_timers_any_authenticated_packet_sent(struct wg_peer *peer)
 {
-	del_timer(&peer->timer_send_keepalive);
+	del_peer_timer(peer, WG_TIMER_SEND_KEEPALIVE);
 }
 
 /* Should be called after any type of authenticated packet is received, whether
@@ -175,13 +282,13 @@ void wg_timers_any_authenticated_packet_sent(struct wg_peer *peer)
  */
 void wg_timers_any_authenticated_packet_received(struct wg_peer *peer)
 {
-	del_timer(&peer->timer_new_handshake);
+	del_peer_timer(peer, WG_TIMER_NEW_HANDSHAKE);
 }
 
 /* Should be called after a handshake initiation message is sent. */
 void wg_timers_handshake_initiated(struct wg_peer *peer)
 {
-	mod_peer_timer(peer, &peer->timer_retransmit_handshake,
+	set_peer_timer(peer, WG_TIMER_RETRANSMIT_HANDSHAKE,
 		       jiffies + REKEY_TIMEOUT * HZ +
 		       prandom_u32_max(REKEY_TIMEOUT_JITTER_MAX_JIFFIES));
 }
@@ -191,10 +298,13 @@ void wg_timers_handshake_initiated(struct wg_peer *peer)
  */
 void wg_timers_handshake_complete(struct wg_peer *peer)
 {
-	del_timer(&peer->timer_retransmit_handshake);
+	del_peer_timer(peer, WG_TIMER_RETRANSMIT_HANDSHAKE);
 	peer->timer_handshake_attempts = 0;
 	peer->sent_lastminute_handshake = false;
 	ktime_get_real_ts64(&peer->walltime_last_handshake);
+	wg_peer_bump_generation(peer);
+	wg_genetlink_notify_peer(peer, WGPEER_EVENT_F_HANDSHAKE_COMPLETE);
+	wg_timers_bring_up_cancel(peer);
 }
 
 /* Should be called after an ephemeral key is created, which is before sending a
@@ -202,7 +312,7 @@ void wg_timers_handshake_complete(struct wg_peer *peer)
  */
 void wg_timers_session_derived(struct wg_peer *peer)
 {
-	mod_peer_timer(peer, &peer->timer_zero_key_material,
+	set_peer_timer(peer, WG_TIMER_ZERO_KEY_MATERIAL,
 		       jiffies + REJECT_AFTER_TIME * 3 * HZ);
 }
 
@@ -212,32 +322,77 @@ void wg_timers_session_derived(struct wg_peer *peer)
 void wg_timers_any_authenticated_packet_traversal(struct wg_peer *peer)
 {
 	if (peer->persistent_keepalive_interval)
-		mod_peer_timer(peer, &peer->timer_persistent_keepalive,
+		set_peer_timer(peer, WG_TIMER_PERSISTENT_KEEPALIVE,
 			jiffies + peer->persistent_keepalive_interval * HZ);
 }
 
+/* Should be called after an event for userspace is made pending. */
+void wg_timers_events_pending(struct wg_peer *peer)
+{
+	unsigned long expires = peer->last_events_sent + PEER_EVENTS_INTERVAL;
+
+	if (!time_in_range(jiffies, peer->last_events_sent, expires))
+		expires = jiffies;
+	if (!peer_timer_pending(peer, WG_TIMER_SEND_EVENTS))
+		set_peer_timer(peer, WG_TIMER_SEND_EVENTS, expires);
+}
+
+/* Should be called for each peer that is to initiate a handshake after the
+ * interface comes up, with awaiting_bring_up set and counted in the device's
+ * bring_up_pending.
+ */
+void wg_timers_bring_up(struct wg_peer *peer, unsigned long delay)
+{
+	if (delay)
+		set_peer_timer(peer, WG_TIMER_BRING_UP, jiffies + delay);
+	else
+		wg_expired_bring_up(peer);
+}
+
+/* Should be called when a peer no longer holds up bring up, either because it
+ * completed a handshake or because it is being removed.
+ */
+void wg_timers_bring_up_cancel(struct wg_peer *peer)
+{
+	if (unlikely(atomic_read(&peer->awaiting_bring_up)) &&
+	    atomic_xchg(&peer->awaiting_bring_up, 0))
+		wg_timers_bring_up_finish(peer->device);
+}
+
+void wg_timers_bring_up_finish(struct wg_device *wg)
+{
+	u64 elapsed;
+
+	if (!atomic_dec_and_test(&wg->bring_up_pending))
+		return;
+	elapsed = ktime_get_coarse_boottime_ns() - wg->bring_up_start;
+	WRITE_ONCE(wg->bring_up_time, max_t(u64, elapsed, 1));
+	pr_debug("%s: All peers completed a handshake %llu ms after coming up\n",
+		 wg->dev->name, div_u64(elapsed, NSEC_PER_MSEC));
+}
+
+void wg_timers_cancel(struct wg_peer *peer, enum wg_timer timer)
+{
+	del_peer_timer(peer, timer);
+}
+
 void wg_timers_init(struct wg_peer *peer)
 {
-	timer_setup(&peer->timer_retransmit_handshake,
-		    wg_expired_retransmit_handshake, 0);
-	timer_setup(&peer->timer_send_keepalive, wg_expired_send_keepalive, 0);
-	timer_setup(&peer->timer_new_handshake, wg_expired_new_handshake, 0);
-	timer_setup(&peer->timer_zero_key_material,
-		    wg_expired_zero_key_material, 0);
-	timer_setup(&peer->timer_persistent_keepalive,
-		    wg_expired_send_persistent_keepalive, 0);
+	timer_setup(&peer->timer, wg_expired_peer_timer, 0);
+	memset(peer->timer_deadlines, 0, sizeof(peer->timer_deadlines));
+#ifdef COMPAT_CANNOT_USE_TIMER_REDUCE
+	spin_lock_init(&peer->timer_lock);
+#endif
 	INIT_WORK(&peer->clear_peer_work, wg_queued_expired_zero_key_material);
 	peer->timer_handshake_attempts = 0;
 	peer->sent_lastminute_handshake = false;
 	peer->timer_need_another_keepalive = false;
+	peer->last_data_sent = jiffies - MAX_JIFFY_OFFSET;
 }
 
 void wg_timers_stop(struct wg_peer *peer)
 {
-	del_timer_sync(&peer->timer_retransmit_handshake);
-	del_timer_sync(&peer->timer_send_keepalive);
-	del_timer_sync(&peer->timer_new_handshake);
-	del_timer_sync(&peer->timer_zero_key_material);
-	del_timer_sync(&peer->timer_persistent_keepalive);
+	del_timer_sync(&peer->timer);
+	memset(peer->timer_deadlines, 0, sizeof(peer->timer_deadlines));
 	flush_work(&peer->clear_peer_work);
 }
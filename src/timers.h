@@ -8,10 +8,23 @@
 
 #include <linux/ktime.h>
 
+struct wg_device;
 struct wg_peer;
 
+enum wg_timer {
+	WG_TIMER_RETRANSMIT_HANDSHAKE,
+	WG_TIMER_SEND_KEEPALIVE,
+	WG_TIMER_NEW_HANDSHAKE,
+	WG_TIMER_ZERO_KEY_MATERIAL,
+	WG_TIMER_PERSISTENT_KEEPALIVE,
+	WG_TIMER_SEND_EVENTS,
+	WG_TIMER_BRING_UP,
+	__WG_TIMER_COUNT
+};
+
 void wg_timers_init(struct wg_peer *peer);
 void wg_timers_stop(struct wg_peer *peer);
+void wg_timers_cancel(struct wg_peer *peer, enum wg_timer timer);
 void wg_timers_data_sent(struct wg_peer *peer);
 void wg_timers_data_received(struct wg_peer *peer);
 void wg_timers_any_authenticated_packet_sent(struct wg_peer *peer);
@@ -20,6 +33,10 @@ void wg_timers_handshake_initiated(struct wg_peer *peer);
 void wg_timers_handshake_complete(struct wg_peer *peer);
 void wg_timers_session_derived(struct wg_peer *peer);
 void wg_timers_any_authenticated_packet_traversal(struct wg_peer *peer);
+void wg_timers_events_pending(struct wg_peer *peer);
+void wg_timers_bring_up(struct wg_peer *peer, unsigned long delay);
+void wg_timers_bring_up_cancel(struct wg_peer *peer);
+void wg_timers_bring_up_finish(struct wg_device *wg);
 
 static inline bool wg_birthdate_has_expired(u64 birthday_nanoseconds,
 					    u64 expiration_seconds)
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (C) 2015-2019 Jason A. Donenfeld <Jason@zx2c4.com>. All Rights Reserved.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM wireguard
+
+#if !defined(_WG_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _WG_TRACE_H
+
+#include "peer.h"
+#include "noise.h"
+
+#include <linux/tracepoint.h>
+
+#ifndef TRACE_DEFINE_ENUM
+#define TRACE_DEFINE_ENUM(a)
+#endif
+
+TRACE_DEFINE_ENUM(MESSAGE_HANDSHAKE_INITIATION);
+TRACE_DEFINE_ENUM(MESSAGE_HANDSHAKE_RESPONSE);
+TRACE_DEFINE_ENUM(MESSAGE_HANDSHAKE_COOKIE);
+
+/* Keypair and nonce are zero where they aren't known yet. */
+DECLARE_EVENT_CLASS(wg_packet,
+	TP_PROTO(const struct wg_peer *peer,
+		 const struct noise_keypair *keypair, u64 nonce,
+		 unsigned int len),
+	TP_ARGS(peer, keypair, nonce, len),
+	TP_STRUCT__entry(
+		__field(u64, peer_id)
+		__field(u64, keypair_id)
+		__field(u64, nonce)
+		__field(unsigned int, len)
+	),
+	TP_fast_assign(
+		__entry->peer_id = peer->internal_id;
+		__entry->keypair_id = keypair ? keypair->internal_id : 0;
+		__entry->nonce = nonce;
+		__entry->len = len;
+	),
+	TP_printk("peer=%llu keypair=%llu nonce=%llu len=%u",
+		  __entry->peer_id, __entry->keypair_id, __entry->nonce,
+		  __entry->len)
+);
+
+#define DEFINE_WG_PACKET_EVENT(name) \
+DEFINE_EVENT(wg_packet, name, \
+	TP_PROTO(const struct wg_peer *peer, \
+		 const struct noise_keypair *keypair, u64 nonce, \
+		 unsigned int len), \
+	TP_ARGS(peer, keypair, nonce, len))
+
+/* A plaintext packet routed to a peer by wg_xmit. */
+DEFINE_WG_PACKET_EVENT(wg_xmit);
+/* A packet taken off the staging queue and assigned a nonce. */
+DEFINE_WG_PACKET_EVENT(wg_staged);
+DEFINE_WG_PACKET_EVENT(wg_encrypted);
+/* An encrypted packet handed to the UDP socket, in order. */
+DEFINE_WG_PACKET_EVENT(wg_tx);
+/* A data packet received for a known keypair, before decryption. */
+DEFINE_WG_PACKET_EVENT(wg_rx);
+DEFINE_WG_PACKET_EVENT(wg_decrypted);
+/* A decrypted packet dropped for a nonce that was too old or already seen. */
+DEFINE_WG_PACKET_EVENT(wg_replay_reject);
+
+/* The peer is NULL for cookies, which are sent and received without one. */
+TRACE_EVENT(wg_handshake,
+	TP_PROTO(const struct wg_peer *peer, u32 type, bool sent),
+	TP_ARGS(peer, type, sent),
+	TP_STRUCT__entry(
+		__field(u64, peer_id)
+		__field(u32, type)
+		__field(bool, sent)
+	),
+	TP_fast_assign(
+		__entry->peer_id = peer ? peer->internal_id : 0;
+		__entry->type = type;
+		__entry->sent = sent;
+	),
+	TP_printk("peer=%llu type=%s %s", __entry->peer_id,
+		  __print_symbolic(__entry->type,
+				   { MESSAGE_HANDSHAKE_INITIATION, "initiation" },
+				   { MESSAGE_HANDSHAKE_RESPONSE, "response" },
+				   { MESSAGE_HANDSHAKE_COOKIE, "cookie" }),
+		  __entry->sent ? "sent" : "received")
+);
+
+/* A keypair became the current one used for sending. */
+TRACE_EVENT(wg_keypair_rotate,
+	TP_PROTO(const struct noise_keypair *keypair),
+	TP_ARGS(keypair),
+	TP_STRUCT__entry(
+		__field(u64, peer_id)
+		__field(u64, keypair_id)
+		__field(bool, initiator)
+	),
+	TP_fast_assign(
+		__entry->peer_id = keypair->entry.peer->internal_id;
+		__entry->keypair_id = keypair->internal_id;
+		__entry->initiator = keypair->i_am_the_initiator;
+	),
+	TP_printk("peer=%llu keypair=%llu initiator=%d", __entry->peer_id,
+		  __entry->keypair_id, __entry->initiator)
+);
+
+TRACE_EVENT(wg_endpoint_change,
+	TP_PROTO(const struct wg_peer *peer, const struct endpoint *endpoint),
+	TP_ARGS(peer, endpoint),
+	TP_STRUCT__entry(
+		__field(u64, peer_id)
+		__array(u8, addr, sizeof(struct sockaddr_in6))
+	),
+	TP_fast_assign(
+		__entry->peer_id = peer->internal_id;
+		memset(__entry->addr, 0, sizeof(__entry->addr));
+		if (endpoint->addr.sa_family == AF_INET)
+			memcpy(__entry->addr, &endpoint->addr4,
+			       sizeof(endpoint->addr4));
+		else if (endpoint->addr.sa_family == AF_INET6)
+			memcpy(__entry->addr, &endpoint->addr6,
+			       sizeof(endpoint->addr6));
+	),
+	TP_printk("peer=%llu endpoint=%pISpfsc", __entry->peer_id,
+		  __entry->addr)
+);
+
+#endif /* _WG_TRACE_H */
+
+/* This is outside of the kernel tree, so it is found relative to -I$(src). */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
@@ -9,7 +9,8 @@
  * netlink, with family WG_GENL_NAME and version WG_GENL_VERSION. It defines two
  * methods: get and set. Note that while they share many common attributes,
  * these two functions actually accept a slightly different set of inputs and
- * outputs.
+ * outputs. It additionally defines one multicast event. The parameters that may
+ * be given when creating a device over rtnetlink are described at the end.
  *
  * WG_CMD_GET_DEVICE
  * -----------------
@@ -20,6 +21,21 @@
  *    WGDEVICE_A_IFINDEX: NLA_U32
  *    WGDEVICE_A_IFNAME: NLA_NUL_STRING, maxlen IFNAMSIZ - 1
  *
+ * It may additionally contain:
+ *
+ *    WGDEVICE_A_FLAGS: NLA_U32, 0 or WGDEVICE_DUMP_F_STATS_ONLY if only
+ *                      statistics should be returned, as described below.
+ *    WGDEVICE_A_SINCE_GENERATION: NLA_U64, if only peers that have changed
+ *                                 since the given WGDEVICE_A_GENERATION of a
+ *                                 previous dump should be returned.
+ *    WGDEVICE_A_PEERS: NLA_NESTED, if only the listed peers should be
+ *                      returned, rather than all of them
+ *        0: NLA_NESTED
+ *            WGPEER_A_PUBLIC_KEY: len WG_KEY_LEN
+ *        0: NLA_NESTED
+ *            ...
+ *        ...
+ *
  * The kernel will then return several messages (NLM_F_MULTI) containing the
  * following tree of nested items:
  *
@@ -28,16 +44,34 @@
  *    WGDEVICE_A_PRIVATE_KEY: NLA_EXACT_LEN, len WG_KEY_LEN
  *    WGDEVICE_A_PUBLIC_KEY: NLA_EXACT_LEN, len WG_KEY_LEN
  *    WGDEVICE_A_LISTEN_PORT: NLA_U16
+ *    WGDEVICE_A_LISTEN_PORT_COUNT: NLA_U16
  *    WGDEVICE_A_FWMARK: NLA_U32
+ *    WGDEVICE_A_BRING_UP_SPREAD: NLA_U32
+ *    WGDEVICE_A_BRING_UP_PENDING: NLA_U32
+ *    WGDEVICE_A_BRING_UP_TIME: NLA_U64
+ *    WGDEVICE_A_GENERATION: NLA_U64
+ *    WGDEVICE_A_SINCE_GENERATION: NLA_U64
  *    WGDEVICE_A_PEERS: NLA_NESTED
  *        0: NLA_NESTED
  *            WGPEER_A_PUBLIC_KEY: NLA_EXACT_LEN, len WG_KEY_LEN
  *            WGPEER_A_PRESHARED_KEY: NLA_EXACT_LEN, len WG_KEY_LEN
  *            WGPEER_A_ENDPOINT: NLA_MIN_LEN(struct sockaddr), struct sockaddr_in or struct sockaddr_in6
+ *            WGPEER_A_ENDPOINT_PORT_COUNT: NLA_U16, only if greater than 1
  *            WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL: NLA_U16
  *            WGPEER_A_LAST_HANDSHAKE_TIME: NLA_EXACT_LEN, struct __kernel_timespec
  *            WGPEER_A_RX_BYTES: NLA_U64
  *            WGPEER_A_TX_BYTES: NLA_U64
+ *            WGPEER_A_ENDPOINT_CACHE_HITS: NLA_U64, the number of sends
+ *                                          that found the route cached
+ *            WGPEER_A_ENDPOINT_CACHE_MISSES: NLA_U64, the number of sends
+ *                                            that needed a route lookup
+ *            WGPEER_A_ENDPOINT_ROAMS: NLA_U64, the number of times an
+ *                                     authenticated packet moved the
+ *                                     endpoint somewhere else
+ *            WGPEER_A_TX_QUEUE_LEN: NLA_U32
+ *            WGPEER_A_TX_QUEUE_PEAK: NLA_U32
+ *            WGPEER_A_RX_QUEUE_LEN: NLA_U32
+ *            WGPEER_A_RX_QUEUE_PEAK: NLA_U32
  *            WGPEER_A_ALLOWEDIPS: NLA_NESTED
  *                0: NLA_NESTED
  *                    WGALLOWEDIP_A_FAMILY: NLA_U16
@@ -49,9 +83,94 @@
  *                    ...
  *                ...
  *            WGPEER_A_PROTOCOL_VERSION: NLA_U32
+ *            WGPEER_A_GENERATION: NLA_U64
  *        0: NLA_NESTED
  *            ...
  *        ...
+ *    WGDEVICE_A_LINK_INFO: NLA_NESTED
+ *        WGLINK_A_MAX_STAGED_PACKETS: NLA_U32
+ *        WGLINK_A_MAX_QUEUED_PACKETS: NLA_U32
+ *        WGLINK_A_MAX_QUEUED_HANDSHAKES: NLA_U32
+ *        WGLINK_A_KEEPALIVE_TIMEOUT: NLA_U32
+ *        WGLINK_A_PEER_HASHTABLE_BITS: NLA_U8
+ *        WGLINK_A_INDEX_HASHTABLE_BITS: NLA_U8
+ *    WGDEVICE_A_LATENCY_STATS: NLA_U8
+ *    WGDEVICE_A_LATENCY: NLA_NESTED, only once latency statistics were enabled
+ *        0: NLA_NESTED
+ *            WGLATENCY_A_STAGE: NLA_U32, one of WGLATENCY_STAGE_*
+ *            WGLATENCY_A_BUCKETS: NLA_BINARY, WGLATENCY_BUCKETS u64 counters
+ *        0: NLA_NESTED
+ *            ...
+ *        ...
+ *    WGDEVICE_A_DROPS: NLA_NESTED
+ *        WGDROP_TX_STAGED_EVICTED: NLA_U64
+ *        WGDROP_TX_QUEUE_FULL: NLA_U64
+ *        ...
+ *        WGDROP_RNG_NOT_READY: NLA_U64
+ *    WGDEVICE_A_ENCRYPT_QUEUE: NLA_NESTED, only with WGDEVICE_DUMP_F_STATS_ONLY
+ *        WGQUEUE_A_LEN: NLA_U32
+ *        WGQUEUE_A_PEAK: NLA_U32
+ *        WGQUEUE_A_LIMIT: NLA_U32
+ *        WGQUEUE_A_BUSY_TIME: NLA_U64
+ *        WGQUEUE_A_WORKERS: NLA_NESTED
+ *            0: NLA_NESTED
+ *                WGWORKER_A_CPU: NLA_U32
+ *                WGWORKER_A_BUSY_TIME: NLA_U64
+ *            0: NLA_NESTED
+ *                ...
+ *            ...
+ *    WGDEVICE_A_DECRYPT_QUEUE: NLA_NESTED, same as WGDEVICE_A_ENCRYPT_QUEUE
+ *    WGDEVICE_A_HANDSHAKE_QUEUE: NLA_NESTED, same as WGDEVICE_A_ENCRYPT_QUEUE
+ *
+ * WGDEVICE_A_LINK_INFO contains the values the device was created with, as
+ * described under RTM_NEWLINK below.
+ *
+ * WGDEVICE_A_BRING_UP_PENDING is the number of peers that were to initiate a
+ * handshake when the device last came up, and have not yet completed one.
+ * Once all have, WGDEVICE_A_BRING_UP_TIME is the number of nanoseconds that
+ * took, and otherwise it is zero.
+ *
+ * While WGDEVICE_A_LATENCY_STATS is 1, packets are timestamped as they move
+ * through the pipeline, and the time spent in each stage is counted in a log2
+ * histogram: bucket 0 counts zero nanoseconds, bucket i counts at least 2^(i-1)
+ * and less than 2^i, and the last bucket counts everything longer. Sending
+ * packets wait in the peer's staging queue (TX_STAGED), then for an encryption
+ * worker (TX_ENCRYPT_QUEUE), are encrypted (TX_ENCRYPT), and then wait to be
+ * sent in order behind earlier packets of the peer (TX_ORDERING). Received
+ * packets likewise wait for a decryption worker (RX_DECRYPT_QUEUE), are
+ * decrypted (RX_DECRYPT), and then wait for in-order delivery by NAPI
+ * (RX_ORDERING). Time spent waiting for a CPU shows up in the queue stages,
+ * while head-of-line blocking shows up in the ordering stages. Only the oldest
+ * packet of each batch is measured while sending. Histograms are kept when
+ * statistics are disabled again, and are reset by enabling them.
+ *
+ * WGDEVICE_A_DROPS counts every packet the device has dropped, by the reason
+ * it was dropped, with one attribute of each WGDROP_* type. The first group of
+ * reasons, up to WGDROP_NOMEM, means the device or system ran out of capacity.
+ * The second group, up to WGDROP_UNALLOWED_SOURCE, means that a packet arrived
+ * that was malformed, unauthenticated, replayed or not allowed, which in
+ * numbers points at an attack rather than at load. The remaining reasons are
+ * due to configuration or state, such as there being no peer or endpoint for
+ * a packet, or its peer or session going away.
+ *
+ * The WGDEVICE_A_*_QUEUE attributes describe the device's work queues, which
+ * are shared by all peers. WGQUEUE_A_LEN is the number of packets waiting in
+ * the queue right now, and WGQUEUE_A_PEAK the most that have been seen waiting
+ * at once, out of at most WGQUEUE_A_LIMIT. The peak of the crypt queues is
+ * sampled whenever a worker starts draining them, so it may fall short of the
+ * true maximum. WGQUEUE_A_BUSY_TIME is the total number of nanoseconds that
+ * the queue's workers have spent processing it, and WGQUEUE_A_WORKERS breaks
+ * this down by CPU, for those that have been busy at all. These are only
+ * returned by WGDEVICE_DUMP_F_STATS_ONLY dumps. As the breakdown grows with
+ * the number of CPUs, it is sent after the rest of the device, in another
+ * WGDEVICE_A_*_QUEUE that contains only WGQUEUE_A_WORKERS, and may continue
+ * in the same way over several messages, before any peers are. It is then up
+ * to the receiver to coalesce these. Likewise, for each peer,
+ * WGPEER_A_TX_QUEUE_LEN and WGPEER_A_RX_QUEUE_LEN are the number of packets
+ * waiting to be sent or received in order, including those still being
+ * encrypted or decrypted, and the _PEAK attributes their high-water marks. A
+ * peer whose queue is full while the device's queues are not is stalled
+ * behind a packet of its own.
  *
  * It is possible that all of the allowed IPs of a single peer will not
  * fit within a single netlink message. In that case, the same peer will
@@ -64,11 +183,72 @@
  * and WGDEVICE_A_PEERS. It is then up to the receiver to coalesce these
  * messages to form the complete list of peers.
  *
+ * If WGDEVICE_DUMP_F_STATS_ONLY is set, WGDEVICE_A_PRIVATE_KEY,
+ * WGDEVICE_A_PUBLIC_KEY, WGPEER_A_PRESHARED_KEY and WGPEER_A_ALLOWEDIPS are
+ * omitted, so that each peer fits within a single message, and the dump is
+ * served without taking the RTNL or any configuration locks. For the same
+ * reason, WGDEVICE_A_IFNAME is omitted, and the device is only identified by
+ * WGDEVICE_A_IFINDEX. This makes it
+ * suitable for frequent polling of devices with many peers and allowed IPs.
+ *
+ * When peers are requested by WGPEER_A_PUBLIC_KEY, they are looked up
+ * directly, which is much cheaper than a dump of all peers on devices
+ * with many of them. They are returned in the order requested, and those
+ * that do not exist are silently left out.
+ *
+ * Every peer carries a WGPEER_A_GENERATION, which changes whenever it is
+ * reconfigured, its endpoint changes, or it completes a handshake. The
+ * device's WGDEVICE_A_GENERATION is sampled at the start of the dump. If
+ * it is passed back in WGDEVICE_A_SINCE_GENERATION of a later dump, only
+ * peers whose generation is greater are returned, and the kernel echoes
+ * WGDEVICE_A_SINCE_GENERATION back to indicate this. If peers have been
+ * removed since then, or the generation is otherwise unknown, the filter
+ * cannot be honored, in which case WGDEVICE_A_SINCE_GENERATION is absent
+ * from the reply and all peers are returned, which should replace the
+ * receiver's state entirely.
+ *
  * Since this is an NLA_F_DUMP command, the final message will always be
  * NLMSG_DONE, even if an error occurs. However, this NLMSG_DONE message
  * contains an integer error code. It is either zero or a negative error
  * code corresponding to the errno.
  *
+ * WG_CMD_PEER_EVENT
+ * -----------------
+ *
+ * Sent by the kernel to the WG_MULTICAST_GROUP_PEERS multicast group of the
+ * network namespace of a device, when something noteworthy happens to one of
+ * its peers, so that userspace does not need to poll. Events of a single peer
+ * are coalesced, and sent no more often than ten times per second per peer.
+ * Joining the group requires CAP_NET_ADMIN in the namespace's user namespace,
+ * as WG_CMD_GET_DEVICE does; on kernels older than 3.19, where this can't be
+ * enforced, only WGDEVICE_A_IFINDEX, WGDEVICE_A_IFNAME and WGPEER_A_EVENTS
+ * are sent. The message contains the following tree of nested items:
+ *
+ *    WGDEVICE_A_IFINDEX: NLA_U32
+ *    WGDEVICE_A_IFNAME: NLA_NUL_STRING, maxlen IFNAMSIZ - 1
+ *    WGDEVICE_A_PEERS: NLA_NESTED
+ *        0: NLA_NESTED
+ *            WGPEER_A_PUBLIC_KEY: NLA_EXACT_LEN, len WG_KEY_LEN
+ *            WGPEER_A_EVENTS: NLA_U32, a mask of WGPEER_EVENT_F_HANDSHAKE_COMPLETE
+ *                             if a handshake was completed, and/or
+ *                             WGPEER_EVENT_F_ENDPOINT_CHANGED if the endpoint
+ *                             changed, and/or WGPEER_EVENT_F_HANDSHAKE_GAVE_UP
+ *                             if no handshake could be completed after
+ *                             retrying for too long, so no more are attempted
+ *                             until there is new traffic for the peer.
+ *            WGPEER_A_ENDPOINT: NLA_MIN_LEN(struct sockaddr), struct sockaddr_in or struct sockaddr_in6
+ *            WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL: NLA_U16
+ *            WGPEER_A_LAST_HANDSHAKE_TIME: NLA_EXACT_LEN, struct __kernel_timespec
+ *            WGPEER_A_RX_BYTES: NLA_U64
+ *            WGPEER_A_TX_BYTES: NLA_U64
+ *            WGPEER_A_PROTOCOL_VERSION: NLA_U32
+ *            WGPEER_A_GENERATION: NLA_U64
+ *
+ * Events are only generated while there are listeners, and only while the
+ * device is up. They are best effort, and may be lost under memory pressure,
+ * so a listener should still reconcile with WG_CMD_GET_DEVICE at startup and
+ * after overruns.
+ *
  * WG_CMD_SET_DEVICE
  * -----------------
  *
@@ -82,7 +262,16 @@
  *                      peers should be removed prior to adding the list below.
  *    WGDEVICE_A_PRIVATE_KEY: len WG_KEY_LEN, all zeros to remove
  *    WGDEVICE_A_LISTEN_PORT: NLA_U16, 0 to choose randomly
+ *    WGDEVICE_A_LISTEN_PORT_COUNT: NLA_U16, the number of consecutive ports,
+ *                                  starting at WGDEVICE_A_LISTEN_PORT, to
+ *                                  listen on, between 1 and 16, 1 by default
  *    WGDEVICE_A_FWMARK: NLA_U32, 0 to disable
+ *    WGDEVICE_A_BRING_UP_SPREAD: NLA_U32, the number of milliseconds over which
+ *                                peers initiate handshakes when the device
+ *                                comes up, each at a random point of an even
+ *                                share of it, 0 for all at once
+ *    WGDEVICE_A_LATENCY_STATS: NLA_U8, 1 to collect latency histograms, as
+ *                              described above, or 0 to stop
  *    WGDEVICE_A_PEERS: NLA_NESTED
  *        0: NLA_NESTED
  *            WGPEER_A_PUBLIC_KEY: len WG_KEY_LEN
@@ -95,6 +284,11 @@
  *                            peer should only be set if it already exists.
  *            WGPEER_A_PRESHARED_KEY: len WG_KEY_LEN, all zeros to remove
  *            WGPEER_A_ENDPOINT: struct sockaddr_in or struct sockaddr_in6
+ *            WGPEER_A_ENDPOINT_PORT_COUNT: NLA_U16, the number of consecutive
+ *                                          ports, starting at the port of
+ *                                          WGPEER_A_ENDPOINT, that the peer
+ *                                          listens on, at most 16, 0 or 1 for
+ *                                          just the one
  *            WGPEER_A_PERSISTENT_KEEPALIVE_INTERVAL: NLA_U16, 0 to disable
  *            WGPEER_A_ALLOWEDIPS: NLA_NESTED
  *                0: NLA_NESTED
@@ -115,6 +309,11 @@
  *            ...
  *        ...
  *
+ * When listening on several ports, packets of different inner flows are sent
+ * from different ones, and likewise to different ports of peers listening on
+ * several, so that receive side scaling spreads them over CPUs on both ends.
+ * A peer sending from any port within its range does not change its endpoint.
+ *
  * It is possible that the amount of configuration data exceeds that of
  * the maximum message length accepted by the kernel. In that case, several
  * messages should be sent one after another, with each successive one
@@ -126,6 +325,37 @@
  * of a peer, it likely should not be specified in subsequent fragments.
  *
  * If an error occurs, NLMSG_ERROR will reply containing an errno.
+ *
+ * RTM_NEWLINK
+ * -----------
+ *
+ * Devices are created over rtnetlink with kind "wireguard". The
+ * IFLA_INFO_DATA of the request may contain any of the following, which are
+ * fixed for the lifetime of the device and default to the value given in
+ * parentheses when absent:
+ *
+ *    WGLINK_A_MAX_STAGED_PACKETS: NLA_U32, how many outgoing packets to hold
+ *                                 per peer while waiting for a handshake
+ *                                 (128), between 1 and 65536.
+ *    WGLINK_A_MAX_QUEUED_PACKETS: NLA_U32, the depth of the encryption and
+ *                                 decryption queues, and of each peer's
+ *                                 queues (1024), between 16 and 65536.
+ *    WGLINK_A_MAX_QUEUED_HANDSHAKES: NLA_U32, the depth of the incoming
+ *                                    handshake queue, an eighth of which
+ *                                    being full puts the device under load
+ *                                    (4096), between 64 and 65536.
+ *    WGLINK_A_KEEPALIVE_TIMEOUT: NLA_U32, how many seconds to wait after
+ *                                receiving data before replying with a
+ *                                keepalive (10), between 1 and 60. This
+ *                                should match on both sides of a tunnel.
+ *    WGLINK_A_PEER_HASHTABLE_BITS: NLA_U8, log2 of the number of buckets of
+ *                                  the public key hashtable (11), between 4
+ *                                  and 20.
+ *    WGLINK_A_INDEX_HASHTABLE_BITS: NLA_U8, log2 of the number of buckets of
+ *                                   the session index hashtable (13),
+ *                                   between 4 and 22.
+ *
+ * These are also returned in IFLA_INFO_DATA of RTM_GETLINK.
  */
 
 #ifndef _WG_UAPI_WIREGUARD_H
@@ -133,12 +363,14 @@
 
 #define WG_GENL_NAME "wireguard"
 #define WG_GENL_VERSION 1
+#define WG_MULTICAST_GROUP_PEERS "peers"
 
 #define WG_KEY_LEN 32
 
 enum wg_cmd {
 	WG_CMD_GET_DEVICE,
 	WG_CMD_SET_DEVICE,
+	WG_CMD_PEER_EVENT,
 	__WG_CMD_MAX
 };
 #define WG_CMD_MAX (__WG_CMD_MAX - 1)
@@ -147,6 +379,10 @@ enum wgdevice_flag {
 	WGDEVICE_F_REPLACE_PEERS = 1U << 0,
 	__WGDEVICE_F_ALL = WGDEVICE_F_REPLACE_PEERS
 };
+enum wgdevice_dump_flag {
+	WGDEVICE_DUMP_F_STATS_ONLY = 1U << 0,
+	__WGDEVICE_DUMP_F_ALL = WGDEVICE_DUMP_F_STATS_ONLY
+};
 enum wgdevice_attribute {
 	WGDEVICE_A_UNSPEC,
 	WGDEVICE_A_IFINDEX,
@@ -157,10 +393,96 @@ enum wgdevice_attribute {
 	WGDEVICE_A_LISTEN_PORT,
 	WGDEVICE_A_FWMARK,
 	WGDEVICE_A_PEERS,
+	WGDEVICE_A_GENERATION,
+	WGDEVICE_A_SINCE_GENERATION,
+	WGDEVICE_A_LINK_INFO,
+	WGDEVICE_A_BRING_UP_SPREAD,
+	WGDEVICE_A_BRING_UP_PENDING,
+	WGDEVICE_A_BRING_UP_TIME,
+	WGDEVICE_A_LISTEN_PORT_COUNT,
+	WGDEVICE_A_LATENCY_STATS,
+	WGDEVICE_A_LATENCY,
+	WGDEVICE_A_DROPS,
+	WGDEVICE_A_ENCRYPT_QUEUE,
+	WGDEVICE_A_DECRYPT_QUEUE,
+	WGDEVICE_A_HANDSHAKE_QUEUE,
 	__WGDEVICE_A_LAST
 };
 #define WGDEVICE_A_MAX (__WGDEVICE_A_LAST - 1)
 
+enum wglatency_stage {
+	WGLATENCY_STAGE_TX_STAGED,
+	WGLATENCY_STAGE_TX_ENCRYPT_QUEUE,
+	WGLATENCY_STAGE_TX_ENCRYPT,
+	WGLATENCY_STAGE_TX_ORDERING,
+	WGLATENCY_STAGE_RX_DECRYPT_QUEUE,
+	WGLATENCY_STAGE_RX_DECRYPT,
+	WGLATENCY_STAGE_RX_ORDERING,
+	__WGLATENCY_STAGE_COUNT
+};
+#define WGLATENCY_BUCKETS 32
+enum wglatency_attribute {
+	WGLATENCY_A_UNSPEC,
+	WGLATENCY_A_STAGE,
+	WGLATENCY_A_BUCKETS,
+	__WGLATENCY_A_LAST
+};
+#define WGLATENCY_A_MAX (__WGLATENCY_A_LAST - 1)
+
+enum wgdrop_reason {
+	WGDROP_UNSPEC,
+	/* Out of capacity: */
+	WGDROP_TX_STAGED_EVICTED,
+	WGDROP_TX_QUEUE_FULL,
+	WGDROP_TX_RING_FULL,
+	WGDROP_RX_QUEUE_FULL,
+	WGDROP_RX_RING_FULL,
+	WGDROP_HANDSHAKE_QUEUE_FULL,
+	WGDROP_HANDSHAKE_UNDER_LOAD,
+	WGDROP_HANDSHAKE_RATELIMITED,
+	WGDROP_NOMEM,
+	/* Invalid or unauthenticated input: */
+	WGDROP_INVALID_HEADER,
+	WGDROP_HANDSHAKE_INVALID_MAC,
+	WGDROP_HANDSHAKE_INVALID,
+	WGDROP_UNKNOWN_KEYPAIR,
+	WGDROP_DECRYPT_FAILED,
+	WGDROP_REPLAYED,
+	WGDROP_INVALID_INNER_PACKET,
+	WGDROP_UNALLOWED_SOURCE,
+	/* Configuration and state: */
+	WGDROP_TX_INVALID_PROTOCOL,
+	WGDROP_TX_NO_PEER,
+	WGDROP_TX_NO_ENDPOINT,
+	WGDROP_TX_NO_ROUTE,
+	WGDROP_TX_GSO_FAILED,
+	WGDROP_TX_ENCRYPT_FAILED,
+	WGDROP_PEER_DEAD,
+	WGDROP_KEYPAIR_EXPIRED,
+	WGDROP_FLUSHED,
+	WGDROP_RNG_NOT_READY,
+	__WGDROP_LAST
+};
+#define WGDROP_MAX (__WGDROP_LAST - 1)
+
+enum wgqueue_attribute {
+	WGQUEUE_A_UNSPEC,
+	WGQUEUE_A_LEN,
+	WGQUEUE_A_PEAK,
+	WGQUEUE_A_LIMIT,
+	WGQUEUE_A_BUSY_TIME,
+	WGQUEUE_A_WORKERS,
+	__WGQUEUE_A_LAST
+};
+#define WGQUEUE_A_MAX (__WGQUEUE_A_LAST - 1)
+enum wgworker_attribute {
+	WGWORKER_A_UNSPEC,
+	WGWORKER_A_CPU,
+	WGWORKER_A_BUSY_TIME,
+	__WGWORKER_A_LAST
+};
+#define WGWORKER_A_MAX (__WGWORKER_A_LAST - 1)
+
 enum wgpeer_flag {
 	WGPEER_F_REMOVE_ME = 1U << 0,
 	WGPEER_F_REPLACE_ALLOWEDIPS = 1U << 1,
@@ -180,10 +502,29 @@ enum wgpeer_attribute {
 	WGPEER_A_TX_BYTES,
 	WGPEER_A_ALLOWEDIPS,
 	WGPEER_A_PROTOCOL_VERSION,
+	WGPEER_A_GENERATION,
+	WGPEER_A_EVENTS,
+	WGPEER_A_ENDPOINT_PORT_COUNT,
+	WGPEER_A_ENDPOINT_CACHE_HITS,
+	WGPEER_A_ENDPOINT_CACHE_MISSES,
+	WGPEER_A_ENDPOINT_ROAMS,
+	WGPEER_A_TX_QUEUE_LEN,
+	WGPEER_A_TX_QUEUE_PEAK,
+	WGPEER_A_RX_QUEUE_LEN,
+	WGPEER_A_RX_QUEUE_PEAK,
 	__WGPEER_A_LAST
 };
 #define WGPEER_A_MAX (__WGPEER_A_LAST - 1)
 
+enum wgpeer_event {
+	WGPEER_EVENT_F_HANDSHAKE_COMPLETE = 1U << 0,
+	WGPEER_EVENT_F_ENDPOINT_CHANGED = 1U << 1,
+	WGPEER_EVENT_F_HANDSHAKE_GAVE_UP = 1U << 2,
+	__WGPEER_EVENT_F_ALL = WGPEER_EVENT_F_HANDSHAKE_COMPLETE |
+			       WGPEER_EVENT_F_ENDPOINT_CHANGED |
+			       WGPEER_EVENT_F_HANDSHAKE_GAVE_UP
+};
+
 enum wgallowedip_attribute {
 	WGALLOWEDIP_A_UNSPEC,
 	WGALLOWEDIP_A_FAMILY,
@@ -193,4 +534,16 @@ enum wgallowedip_attribute {
 };
 #define WGALLOWEDIP_A_MAX (__WGALLOWEDIP_A_LAST - 1)
 
+enum wglink_attribute {
+	WGLINK_A_UNSPEC,
+	WGLINK_A_MAX_STAGED_PACKETS,
+	WGLINK_A_MAX_QUEUED_PACKETS,
+	WGLINK_A_MAX_QUEUED_HANDSHAKES,
+	WGLINK_A_KEEPALIVE_TIMEOUT,
+	WGLINK_A_PEER_HASHTABLE_BITS,
+	WGLINK_A_INDEX_HASHTABLE_BITS,
+	__WGLINK_A_LAST
+};
+#define WGLINK_A_MAX (__WGLINK_A_LAST - 1)
+
 #endif /* _WG_UAPI_WIREGUARD_H */